@@ -0,0 +1,134 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+// Host benchmark for the uplink compression stage. Reports compression
+// ratio and cycles per input byte on typical telemetry payloads.
+//
+// Build and run on the host from the repository root:
+//   g++ -O2 -Isrc benchmarks/compression/main.cpp src/compression.cpp -o compression_bench
+//   ./compression_bench
+//
+// Cycles are read from the time stamp counter on x86, elsewhere they
+// are estimated from wall clock time assuming a 1 GHz clock.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "compression.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static unsigned long long cycles() { return __rdtsc(); }
+#else
+static unsigned long long cycles() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+using namespace Narrowband;
+
+static const int iterations = 2000;
+
+struct Sample {
+    const char  *name;
+    uint8_t     data[Compressor::max_input];
+    size_t      length;
+};
+
+// one JSON reading as sent by a typical sensor
+static size_t json_reading(char *p, size_t sz, int i) {
+    return snprintf(p, sz, "{\"dev\":\"nb-0042\",\"ts\":%d,\"temp\":%.2f,\"hum\":%.1f,\"bat\":%.2f,\"rssi\":%d}",
+        1539943200+60*i, 21.5+sin(i/10.0), 45.0+i%7*0.3, 3.71-i*0.001, -87+i%5);
+}
+
+static void make_samples(Sample *s) {
+    // single JSON reading
+    s[0].name = "json, 1 reading";
+    s[0].length = json_reading((char*)s[0].data, sizeof(s[0].data), 0);
+
+    // several readings coalesced into one datagram
+    s[1].name = "json, 12 readings";
+    s[1].length = 0;
+    for ( int i = 0; i < 12; i++) {
+        s[1].length += json_reading((char*)s[1].data+s[1].length, sizeof(s[1].data)-s[1].length, i);
+    }
+
+    // 16 bit little endian samples of a slowly changing value
+    s[2].name = "int16 series";
+    s[2].length = 600;
+    srand(7);
+    for ( size_t i = 0; i < s[2].length/2; i++) {
+        int v = 2150+(int)(30*sin(i/25.0))+rand()%3;
+        s[2].data[2*i] = (uint8_t)v;
+        s[2].data[2*i+1] = (uint8_t)(v >> 8);
+    }
+
+    // incompressible
+    s[3].name = "random";
+    s[3].length = 600;
+    for ( size_t i = 0; i < s[3].length; i++) {
+        s[3].data[i] = (uint8_t)rand();
+    }
+}
+
+static void run(const Sample& s, size_t stride) {
+    Compressor *p_c = new Compressor(stride);
+    Compressor& c = *p_c;
+    static uint8_t out[Compressor::max_input];
+
+    unsigned long long t0 = cycles();
+    for ( int i = 0; i < iterations; i++) {
+        c.compress(s.data, s.length);
+    }
+    unsigned long long t1 = cycles();
+
+    size_t n = 0;
+    unsigned long long t2 = cycles();
+    for ( int i = 0; i < iterations; i++) {
+        Compressor::decompress(c.data(), c.size(), out, sizeof(out), n);
+    }
+    unsigned long long t3 = cycles();
+
+    bool ok = (n == s.length && memcmp(out, s.data, n) == 0);
+    printf("%-20s %6u %6u %6u %7.1f%% %10.1f %10.1f %s\n", s.name, (unsigned int)stride,
+        (unsigned int)s.length, (unsigned int)c.size(), 100.0*c.size()/s.length,
+        (double)(t1-t0)/iterations/s.length, (double)(t3-t2)/iterations/s.length,
+        ok?"":"ROUNDTRIP FAILED");
+
+    delete p_c;
+}
+
+int main() {
+    static Sample samples[4];
+    make_samples(samples);
+
+    printf("%-20s %6s %6s %6s %8s %10s %10s\n", "sample", "delta", "in", "out", "ratio", "comp c/B", "decomp c/B");
+    for ( size_t i = 0; i < 4; i++) {
+        run(samples[i], 0);
+        if ( i >= 2) {
+            run(samples[i], 2);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+// Host benchmark for the hex codec used on the UART, compares it with the
+// former malloc/sprintf based encoding of UDPSocketControl::sendTo.
+//
+// Build and run on the host from the repository root:
+//   g++ -O2 -Isrc benchmarks/hexcodec/main.cpp src/hexcodec.cpp -o hexcodec_bench
+//   ./hexcodec_bench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hexcodec.h"
+
+using namespace Narrowband;
+
+static const size_t max_payload = 1358;
+static const int iterations = 20000;
+
+static volatile size_t sink = 0;
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// sendTo as it was: heap buffer, one sprintf per byte, then the
+// whole command into a 2048 byte stack buffer.
+static void legacy_encode(const uint8_t *p_data, size_t length) {
+    size_t n = 1+length*2;
+    char *hexbuf = (char*)malloc(n);
+    memset(hexbuf,0,n);
+
+    char *q = hexbuf;
+    for ( size_t i = 0; i < length; i++) {
+        sprintf(q, "%.2X", p_data[i]);
+        q += 2;
+    }
+
+    char buf[2048];
+    snprintf(buf,sizeof(buf), "AT+NSOST=%d,%s,%d,%d,%s", 1, "10.0.0.1", 9876, (int)length, hexbuf);
+    free(hexbuf);
+    sink += buf[sizeof(buf)/2];
+}
+
+// sendTo now: header, then table encoding right behind it.
+static void table_encode(const uint8_t *p_data, size_t length) {
+    char buf[64+2*max_payload+1];
+    int n = snprintf(buf,sizeof(buf), "AT+NSOST=%d,%s,%u,%u,", 1, "10.0.0.1", 9876, (unsigned int)length);
+    buf[n+hex_encode(p_data, length, buf+n)] = 0;
+    sink += buf[n];
+}
+
+static int hex_value(char c) {
+    if ( c >= '0' && c <= '9') return c-'0';
+    if ( c >= 'A' && c <= 'F') return c-'A'+10;
+    if ( c >= 'a' && c <= 'f') return c-'a'+10;
+    return -1;
+}
+
+// per character decoding as used by recvFrom before
+static void legacy_decode(const char *p_hex, size_t length, uint8_t *p_out) {
+    for ( size_t i = 0; i < length; i++) {
+        int hi = hex_value(*p_hex++);
+        int lo = hex_value(*p_hex++);
+        if ( hi < 0 || lo < 0) {
+            return;
+        }
+        p_out[i] = (uint8_t)((hi << 4) | lo);
+    }
+    sink += p_out[0];
+}
+
+static void table_decode(const char *p_hex, size_t length, uint8_t *p_out) {
+    sink += hex_decode(p_hex, length, p_out);
+}
+
+typedef void (*encode_fn)(const uint8_t *, size_t);
+typedef void (*decode_fn)(const char *, size_t, uint8_t *);
+
+static double run_encode(encode_fn f, const uint8_t *p_data, size_t length) {
+    double t0 = now_sec();
+    for ( int i = 0; i < iterations; i++) {
+        f(p_data, length);
+    }
+    return (now_sec()-t0)*1e9/((double)iterations*length);
+}
+
+static double run_decode(decode_fn f, const char *p_hex, size_t length, uint8_t *p_out) {
+    double t0 = now_sec();
+    for ( int i = 0; i < iterations; i++) {
+        f(p_hex, length, p_out);
+    }
+    return (now_sec()-t0)*1e9/((double)iterations*length);
+}
+
+int main() {
+    static uint8_t data[max_payload];
+    static char hex[2*max_payload+1];
+    static uint8_t out[max_payload];
+
+    srand(42);
+    for ( size_t i = 0; i < max_payload; i++) {
+        data[i] = (uint8_t)rand();
+    }
+    hex[hex_encode(data, max_payload, hex)] = 0;
+
+    // 1000 bytes is the largest payload the old 2048 byte command buffer held
+    const size_t sizes[] = { 16, 64, 256, 1000 };
+
+    printf("%-8s %14s %14s %8s %14s %14s %8s\n", "bytes",
+        "enc old ns/B", "enc new ns/B", "speedup",
+        "dec old ns/B", "dec new ns/B", "speedup");
+    for ( size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+        size_t n = sizes[i];
+        double e_old = run_encode(legacy_encode, data, n);
+        double e_new = run_encode(table_encode, data, n);
+        double d_old = run_decode(legacy_decode, hex, n, out);
+        double d_new = run_decode(table_decode, hex, n, out);
+        printf("%-8u %14.2f %14.2f %7.1fx %14.2f %14.2f %7.1fx\n", (unsigned int)n,
+            e_old, e_new, e_old/e_new, d_old, d_new, d_old/d_new);
+    }
+
+    if ( memcmp(data, out, 1000) != 0) {
+        printf("decode mismatch\n");
+        return 1;
+    }
+    return 0;
+}
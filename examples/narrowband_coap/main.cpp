@@ -0,0 +1,77 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#include <mbed.h>
+#include "narrowband.h"
+#include "udptransport.h"
+#include "coap.h"
+
+// connect serials to USB (pc), set default baud rate
+Serial pc(USBTX, USBRX, 115200); 
+
+// Check your board's spec which pins map to the modem shield
+// and make sure these pins do not interfere with other serials (!)
+// baud rate 9600 default for BC68, BC95
+RawSerial modem(PA_0, PA_1, 9600);
+
+// CommandAdapter on top of the raw serial modem
+Narrowband::CommandAdapter<mbed::RawSerial> mca(modem);
+
+Narrowband::NarrowbandCore nbc(mca);
+Narrowband::Narrowband nb(nbc);
+
+// messages are built and received here
+uint8_t coap_tx[Narrowband::UDPSocketControl::max_payload];
+uint8_t coap_rx[512];
+
+int main() {
+    wait(1);
+
+    printf("Sample CoAP client. Compile with -D __NBIOT_MBED_DEBUG_1 -D __NBIOT_MBED_DEBUG_0\n");
+    printf("to see modem debug I/O.\n\n");
+
+    if (!nb.boot() || !nb.waitForAttach(180000)) {
+        printf("Error attaching to NB network.\n");
+        return 1;
+    }
+
+    // socket stays open for all requests, replies are notified by +NSONMI
+    Narrowband::UDPSocketControl sc = nbc.udp();
+    sc.setReceiveControl(true);
+    if (!sc.open()) {
+        printf("Error opening socket.\n");
+        return 1;
+    }
+
+    Narrowband::UDPSocketTransport transport(sc, "10.0.0.1", 5683, nbc.profile().max_payload);
+    Narrowband::CoapClient client(transport, coap_tx, sizeof(coap_tx), coap_rx, sizeof(coap_rx), (uint32_t)us_ticker_read());
+
+    const char *p_reading = "{\"t\":21.5}";
+    Narrowband::CoapResponse r;
+    if (client.post("sensors/temp", (const uint8_t*)p_reading, strlen(p_reading), r)) {
+        printf("response %d.%02d, %u bytes\n", r.code >> 5, r.code & 0x1F, (unsigned int)r.payload_length);
+    } else {
+        printf("no response.\n");
+    }
+    printf("retransmissions: %lu\n", client.retransmissions());
+
+    sc.close();
+    pc.printf("DONE>\n");
+}
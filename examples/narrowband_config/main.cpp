@@ -60,7 +60,16 @@ int main() {
     // modify an item and update
     list<int>& activeBands = cfg.bands.get();
     activeBands.push_back(8);
-    nb.configure(cfg);
+
+    // only settings that differ are written
+    Narrowband::ConfigureResult res;
+    if (nb.configure(cfg, res)) {
+        printf("Changed:%s%s%s\n", (res.changed & Narrowband::ConfigEcho)?" echo":"",
+            (res.changed & Narrowband::ConfigBands)?" bands":"", (res.changed & Narrowband::ConfigOperator)?" operator":"");
+        if (res.b_reboot_required) {
+            nbc.reboot();
+        }
+    }
 
 
     //
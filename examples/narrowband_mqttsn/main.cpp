@@ -0,0 +1,82 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#include <mbed.h>
+#include "narrowband.h"
+#include "udptransport.h"
+#include "mqttsn.h"
+
+// connect serials to USB (pc), set default baud rate
+Serial pc(USBTX, USBRX, 115200); 
+
+// Check your board's spec which pins map to the modem shield
+// and make sure these pins do not interfere with other serials (!)
+// baud rate 9600 default for BC68, BC95
+RawSerial modem(PA_0, PA_1, 9600);
+
+// CommandAdapter on top of the raw serial modem
+Narrowband::CommandAdapter<mbed::RawSerial> mca(modem);
+
+Narrowband::NarrowbandCore nbc(mca);
+Narrowband::Narrowband nb(nbc);
+
+// messages are built and received here
+uint8_t mqttsn_tx[256];
+uint8_t mqttsn_rx[64];
+
+int main() {
+    wait(1);
+
+    printf("Sample MQTT-SN client. Compile with -D __NBIOT_MBED_DEBUG_1 -D __NBIOT_MBED_DEBUG_0\n");
+    printf("to see modem debug I/O.\n\n");
+
+    if (!nb.boot() || !nb.waitForAttach(180000)) {
+        printf("Error attaching to NB network.\n");
+        return 1;
+    }
+
+    // socket stays open, acknowledgements are notified by +NSONMI
+    Narrowband::UDPSocketControl sc = nbc.udp();
+    sc.setReceiveControl(true);
+    if (!sc.open()) {
+        printf("Error opening socket.\n");
+        return 1;
+    }
+
+    Narrowband::UDPSocketTransport transport(sc, "10.0.0.1", 1883);
+    Narrowband::MqttSnClient client(transport, mqttsn_tx, sizeof(mqttsn_tx), mqttsn_rx, sizeof(mqttsn_rx));
+
+    if (client.connect("nbiot-sample", 600)) {
+        // the topic is registered on the first publish, later
+        // publishes only carry its 2 byte ID
+        for (int i = 0; i < 3; i++) {
+            char reading[16];
+            snprintf(reading, sizeof(reading), "%d", 20+i);
+            printf("publish %s\n", client.publish("sensors/temp", (const uint8_t*)reading, strlen(reading), 1)?"ok":"failed");
+            wait(10);
+        }
+        client.disconnect();
+    } else {
+        printf("gateway did not accept connection.\n");
+    }
+
+    sc.close();
+    pc.printf("DONE>\n");
+}
@@ -0,0 +1,142 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+#include <mbed.h>
+#include "narrowband.h"
+#include "modempool.h"
+#include "mockserial.h"
+
+// Spreads uplinks over several modems. Runs against emulated modems
+// (MockSerial) so the scaling can be measured without hardware, swap
+// in RawSerial instances for real modules.
+
+// connect serials to USB (pc), set default baud rate
+Serial pc(USBTX, USBRX, 115200);
+
+static const size_t num_modems = Narrowband::ModemPool::max_modems;
+static const size_t num_senders = 8;
+static const size_t datagrams_per_sender = 12;
+static const unsigned long modem_latency = 20;      // msecs per command, emulated time on air
+
+static const char *payload = "0123456789abcdef0123456789abcdef";
+
+struct EmulatedModem {
+    MockSerial                                  serial;
+    Narrowband::CommandAdapter<MockSerial>      ca;
+    Narrowband::NarrowbandCore                  core;
+    Narrowband::Narrowband                      nb;
+
+    EmulatedModem() : ca(serial), core(ca), nb(core) { }
+
+    void setup(int rssi, bool b_failing) {
+        char csq[128];
+        snprintf(csq, sizeof(csq), "+CSQ:%d,99\r\n+CEREG:0,1\r\n+CSCON:0,0\r\n+CGATT:1\r\n+CGACT:1,1\r\nOK\r\n", rssi);
+
+        serial.reset();
+        serial.setLatency(modem_latency);
+        serial.addRule("AT+CSQ;+CEREG?;+CSCON?;+CGATT?;+CGACT?\r\n", csq);
+        serial.addRule("AT+NSOCR=*\r\n", "0\r\nOK\r\n");
+        serial.addRule("AT+NSOCL=*\r\n", "OK\r\n");
+        serial.addRule("AT+NSOST=0,*\r\n", b_failing?"ERROR\r\n":"0,32\r\nOK\r\n");
+    }
+};
+
+// sends its share of datagrams through the pool
+class Sender {
+public:
+    Sender() : _p_pool(NULL), _sent(0) { }
+
+    void start(Narrowband::ModemPool *p_pool) {
+        _p_pool = p_pool;
+        _sent = 0;
+        _thread.start(callback(this, &Sender::run));
+    }
+    void join() { _thread.join(); }
+    size_t sent() const { return _sent; }
+
+private:
+    void run() {
+        for ( size_t i = 0; i < datagrams_per_sender; i++) {
+            if ( _p_pool->sendUDP("10.0.0.1", 9876, payload)) {
+                _sent++;
+            }
+        }
+    }
+
+    Narrowband::ModemPool   *_p_pool;
+    size_t                  _sent;
+    Thread                  _thread;
+};
+
+static EmulatedModem modems[num_modems];
+
+// sends all datagrams through a pool of the first n modems, returns throughput
+static unsigned long run(size_t n, bool b_fail_first) {
+    Narrowband::ModemPool pool;
+    for ( size_t i = 0; i < n; i++) {
+        modems[i].setup(10+(int)i, b_fail_first && i == 0);
+        modems[i].nb.resetSockets();
+        pool.add(modems[i].nb);
+    }
+    pool.poll();
+
+    Sender *senders = new Sender[num_senders];
+    for ( size_t i = 0; i < num_senders; i++) {
+        senders[i].start(&pool);
+    }
+    size_t sent = 0;
+    for ( size_t i = 0; i < num_senders; i++) {
+        senders[i].join();
+        sent += senders[i].sent();
+    }
+    delete [] senders;
+
+    Narrowband::ModemPoolStats st;
+    pool.stats(st);
+    printf("%u modem(s): %u datagrams in %lu ms, %lu bytes/s, %lu failovers, %lu failed\n",
+        (unsigned int)n, (unsigned int)sent, st.elapsed, st.throughput, st.failovers, st.failed);
+    for ( size_t i = 0; i < n; i++) {
+        Narrowband::PooledModemStats ms;
+        pool.modemStats(i, ms);
+        printf("  modem %u: sent %lu, failed %lu, rssi %d\n", (unsigned int)i, ms.sent, ms.failed, ms.rssi);
+    }
+    return st.throughput;
+}
+
+int main() {
+    printf("Throughput of a ModemPool over %u emulated modems, %u senders.\n\n",
+        (unsigned int)num_modems, (unsigned int)num_senders);
+
+    unsigned long base = 0;
+    for ( size_t n = 1; n <= num_modems; n++) {
+        unsigned long tp = run(n, false);
+        if ( n == 1) {
+            base = tp;
+        }
+        if ( base > 0) {
+            printf("  speedup %lu.%02lu\n", tp/base, ((tp*100)/base)%100);
+        }
+    }
+
+    // first modem rejects every datagram, the others take over
+    printf("\nwith a failing modem:\n");
+    run(num_modems, true);
+
+    pc.printf("DONE>\n");
+}
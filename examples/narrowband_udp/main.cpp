@@ -32,43 +32,54 @@ RawSerial modem(PA_0, PA_1, 9600);
 // CommandAdapter on top of the raw serial modem
 Narrowband::CommandAdapter<mbed::RawSerial> mca(modem);
 
-Narrowband::NarrowbandCore nbc(mca);
+// timeouts and limits of the BC95, use BC68Profile for the BC68
+Narrowband::NarrowbandCoreFor<Narrowband::BC95Profile> nbc(mca);
 Narrowband::Narrowband nb(nbc);
 
+// called from the CommandAdapter's thread, do not send commands here
+void on_attach(bool b_attached, unsigned long ms) {
+    if (!b_attached) {
+        printf("registration denied after %lu ms.\n", ms);
+    }
+}
+
 int main() {
     wait(1);
 
     printf("Sample board info query. Compile with -D __NBIOT_MBED_DEBUG_1 -D __NBIOT_MBED_DEBUG_0\n");
     printf("to see modem debug I/O.\n\n");
 
-    while(nbc.ready() == false) {
-        wait(2);
-    }
-
-    nbc.reportError().set(true);
-    wait(1);
-
-
-    if(nb.startAttach()) {
-        while(true) {
-            wait(2); printf(".");
-            if (nb.isAttached()) {
-                printf("attached.\n");
-                break;
-            }
+    // probes until the modem is ready, then runs the init commands and
+    // starts to attach. Attach completes on the +CEREG URC, no need to
+    // poll AT+CGATT?
+    if(nb.boot(Narrowband::Narrowband::default_boot_ready_timeout, callback(on_attach))) {
+        if (nb.waitForAttach(180000)) {
+            printf("attached after %lu ms.\n", nb.timeToAttach());
+        } else {
+            printf("not attached.\n");
         }
     } else {
         printf("Error attaching to NB network.\n");
     }
 
-    Narrowband::ConnectionStatusControl cs = nbc.connectionStatus();
-    printf("modem...\nis %s\n", (cs.isConnected())?"connected":"idle");
-    printf("%s registered.\n", nbc.networkRegistrationStatus().isRegistered()?"is":"is not");
-    printf("%s attached.\n", nbc.attachment().isAttached()?"is":"is not");
-    printf("RSSI: %d\n", nbc.signalQuality().getRSSI());
+    // all status values in one go
+    Narrowband::ModemStatus st;
+    if (nbc.status(st)) {
+        printf("modem...\nis %s\n", (st.connection == 1)?"connected":"idle");
+        printf("%s registered.\n", (st.registration == 1 || st.registration == 5)?"is":"is not");
+        printf("%s attached.\n", (st.attached == 1)?"is":"is not");
+        printf("RSSI: %d\n", st.rssi);
+    }
+
 
+    // nothing to wait for, let the modem release the connection right away
+    nb.sendUDP("10.0.0.1", 9876, "This_is_a_test", Narrowband::SendReleaseAfterUplink);
 
-    nb.sendUDP("10.0.0.1", 9876, "This_is_a_test");
+    // where the time to the first packet went, msecs since boot()
+    const Narrowband::BootTimings& bt = nb.bootTimings();
+    printf("ready %lu (%u probes), CMEE %lu, echo %lu, CFUN %lu, CGATT %lu, attached %lu, first packet %lu\n",
+        bt.ready, bt.probes, bt.error_reporting, bt.echo_off, bt.functionality,
+        bt.attach_started, bt.attached, bt.first_packet);
 
     pc.printf("DONE>\n");
 }
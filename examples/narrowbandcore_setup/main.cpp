@@ -71,7 +71,18 @@ int main() {
     // set config entry
     Narrowband::NConfigControl ncc = nbc.nconfig();
     ncc.get();
-    ncc.set("AUTOCONNECT", "TRUE");
+
+    // several keys are written in one pass, without reading back
+    ncc.stage("AUTOCONNECT", "TRUE");
+    ncc.stage("CELL_RESELECTION", "TRUE");
+    if (!ncc.commit()) {
+        const list<Narrowband::NConfigWrite>& w = ncc.writes();
+        for ( list<Narrowband::NConfigWrite>::const_iterator it = w.begin(); it != w.end(); ++it) {
+            if (it->status == Narrowband::NConfigFailed) {
+                printf("Failed to set %s\n", it->key.c_str());
+            }
+        }
+    }
     
     
     pc.printf("DONE>\n");
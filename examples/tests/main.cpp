@@ -2,6 +2,13 @@
 
 #include "commandadapter.h"
 #include "narrowbandcore.h"
+#include "narrowband.h"
+#include "hexcodec.h"
+#include "compression.h"
+#include "outbox.h"
+#include "udptransport.h"
+#include "modempool.h"
+#include "retryadapter.h"
 #include "mockserial.h"
 
 using namespace Narrowband;
@@ -10,6 +17,8 @@ using namespace Narrowband;
 Serial pc(USBTX, USBRX); 
 MockSerial modem;
 CommandAdapter<MockSerial> mca(modem);
+NarrowbandCore nbc(mca);
+Narrowband::Narrowband nb(nbc);
 
 size_t ASSERT_NUM_TOTAL = 0;
 size_t ASSERT_NUM_OK = 0;
@@ -88,6 +97,974 @@ void testErrCode() {
     TEST_ASSERT(r.getErrCode() == 47);
 }
 
+// the socket is opened once and reused for subsequent sends
+void testUDPSocketReuse() {
+    modem.reset();
+    modem.addExchange("AT+NSOCR=DGRAM,17,*,0\r\n", "1\r\nOK\r\n");
+    modem.addExchange("AT+NSOST=1,10.0.0.1,9876,2,4142\r\n", "1,2\r\nOK\r\n");
+    modem.addExchange("AT+NSOST=1,10.0.0.1,9876,2,4344\r\n", "1,2\r\nOK\r\n");
+
+    TEST_ASSERT(nb.sendUDP("10.0.0.1", 9876, "AB") == true);
+    TEST_ASSERT(nb.sendUDP("10.0.0.1", 9876, "CD") == true);
+
+    // a failing socket is replaced by a fresh one
+    modem.addExchange("AT+NSOST=1,10.0.0.1,9876,2,4546\r\n", "ERROR\r\n");
+    modem.addExchange("AT+NSOCL=1\r\n", "ERROR\r\n");
+    modem.addExchange("AT+NSOCR=DGRAM,17,*,0\r\n", "2\r\nOK\r\n");
+    modem.addExchange("AT+NSOST=2,10.0.0.1,9876,2,4546\r\n", "2,2\r\nOK\r\n");
+
+    TEST_ASSERT(nb.sendUDP("10.0.0.1", 9876, "EF") == true);
+
+    // release assistance goes through AT+NSOSTF
+    modem.addExchange("AT+NSOSTF=2,10.0.0.1,9876,0x200,2,4748\r\n", "2,2\r\nOK\r\n");
+    TEST_ASSERT(nb.sendUDP("10.0.0.1", 9876, "GH", SendReleaseAfterUplink) == true);
+
+    modem.addExchange("AT+NSOCL=2\r\n", "OK\r\n");
+    nb.closeSockets();
+}
+
+// +NSONMI notifies about waiting data, which is read with AT+NSORF
+void testUDPRecvFrom() {
+    modem.reset();
+
+    UDPSocketControl sc = nbc.udp();
+    sc.setReceiveControl(true);
+    modem.addExchange("AT+NSOCR=DGRAM,17,*,1\r\n", "0\r\nOK\r\n");
+    TEST_ASSERT(sc.open() == true);
+
+    uint8_t buf[4];
+    string addr;
+    unsigned int port = 0;
+    size_t len = 0, rem = 0;
+
+    // nothing notified yet
+    TEST_ASSERT(sc.recvFrom(sizeof(buf), buf, addr, port, len, rem) == false);
+
+    modem.addExchange("", "+NSONMI:0,6\r\n");
+    TEST_ASSERT(sc.waitForData(TIMEOUT) == true);
+    TEST_ASSERT(sc.pending() == 6);
+
+    modem.addExchange("AT+NSORF=0,4\r\n", "0,10.0.0.1,5683,4,DEADBEEF,2\r\nOK\r\n");
+    TEST_ASSERT(sc.recvFrom(sizeof(buf), buf, addr, port, len, rem) == true);
+    TEST_ASSERT(len == 4 && rem == 2);
+    TEST_ASSERT(buf[0] == 0xDE && buf[1] == 0xAD && buf[2] == 0xBE && buf[3] == 0xEF);
+    TEST_ASSERT(addr == "10.0.0.1" && port == 5683);
+    TEST_ASSERT(sc.pending() == 2);
+
+    modem.addExchange("AT+NSORF=0,4\r\n", "0,10.0.0.1,5683,2,0102,0\r\nOK\r\n");
+    TEST_ASSERT(sc.recvFrom(sizeof(buf), buf, addr, port, len, rem) == true);
+    TEST_ASSERT(len == 2 && rem == 0);
+    TEST_ASSERT(buf[0] == 0x01 && buf[1] == 0x02);
+    TEST_ASSERT(sc.pending() == 0);
+
+    modem.addExchange("AT+NSOCL=0\r\n", "OK\r\n");
+    TEST_ASSERT(sc.close() == true);
+}
+
+// hex encoding/decoding roundtrip, odd lengths and invalid input
+void testHexCodec() {
+    uint8_t data[11] = { 0x00, 0x01, 0x7F, 0x80, 0xAB, 0xCD, 0xEF, 0xFF, 0x10, 0x9A, 0x5C };
+    char hex[2*sizeof(data)+1];
+
+    hex[hex_encode(data, sizeof(data), hex)] = 0;
+    TEST_ASSERT(strcmp(hex, "00017F80ABCDEFFF109A5C") == 0);
+
+    uint8_t out[sizeof(data)];
+    TEST_ASSERT(hex_decode(hex, sizeof(data), out) == true);
+    TEST_ASSERT(memcmp(data, out, sizeof(data)) == 0);
+
+    TEST_ASSERT(hex_decode("abcdef0123", 5, out) == true);
+    TEST_ASSERT(out[0] == 0xAB && out[2] == 0xEF && out[4] == 0x23);
+
+    TEST_ASSERT(hex_decode("0011G233", 4, out) == false);
+    TEST_ASSERT(hex_decode("00112233445566X7", 8, out) == false);
+}
+
+// payload is hex encoded behind the command header while sending
+void testSendPayload() {
+    uint8_t data[40];
+    string expect = "AT+UNITTEST=";
+    for ( size_t i = 0; i < sizeof(data); i++) {
+        char hex[3];
+        data[i] = (uint8_t)(i*7);
+        snprintf(hex, sizeof(hex), "%02X", data[i]);
+        expect += hex;
+    }
+    expect += "\r\n";
+
+    modem.reset();
+    modem.addExchange(expect, "OK\r\n");
+
+    ModemResponse r;
+    TEST_ASSERT(mca.sendPayload("AT+UNITTEST=", data, sizeof(data), r, TIMEOUT) == true);
+    TEST_ASSERT(r.isOk() == true);
+}
+
+// batch send stops at the first datagram not sent
+void testUDPSendBatch() {
+    modem.reset();
+
+    UDPSocketControl sc = nbc.udp();
+    modem.addExchange("AT+NSOCR=DGRAM,17,*,0\r\n", "1\r\nOK\r\n");
+    TEST_ASSERT(sc.open() == true);
+
+    const uint8_t a[] = { 0x01 }, b[] = { 0x02, 0x03 };
+    UDPDatagram d[4];
+    d[0] = UDPDatagram("10.0.0.1", 9876, sizeof(a), a);
+    d[1] = UDPDatagram("10.0.0.1", 9876, UDPSocketControl::max_payload+1, b);
+    d[2] = UDPDatagram("10.0.0.2", 9876, sizeof(b), b);
+    d[3] = UDPDatagram("10.0.0.1", 9876, sizeof(a), a);
+
+    modem.addExchange("AT+NSOST=1,10.0.0.1,9876,1,01\r\n", "1,1\r\nOK\r\n");
+
+    // invalid ones stop it as modem errors do
+    TEST_ASSERT(sc.sendBatch(d, 4) == 1);
+    TEST_ASSERT(d[0].status == UDPSendOk);
+    TEST_ASSERT(d[1].status == UDPSendInvalid);
+    TEST_ASSERT(d[2].status == UDPSendNotSent);
+    TEST_ASSERT(d[3].status == UDPSendNotSent);
+
+    modem.addExchange("AT+NSOST=1,10.0.0.2,9876,2,0203\r\n", "ERROR\r\n");
+    TEST_ASSERT(sc.sendBatch(d+2, 2) == 0);
+    TEST_ASSERT(d[2].status == UDPSendError);
+    TEST_ASSERT(d[3].status == UDPSendNotSent);
+
+    modem.addExchange("AT+NSOCL=1\r\n", "OK\r\n");
+    TEST_ASSERT(sc.close() == true);
+}
+
+// compression roundtrip, incompressible payloads are stored
+void testCompression() {
+    static Compressor c(2);
+    uint8_t data[200];
+    uint8_t out[sizeof(data)];
+    size_t n = 0;
+
+    // slowly rising 16 bit values
+    for ( size_t i = 0; i < sizeof(data)/2; i++) {
+        data[2*i] = (uint8_t)(1000+i*3);
+        data[2*i+1] = (uint8_t)((1000+i*3) >> 8);
+    }
+    TEST_ASSERT(c.compress(data, sizeof(data)) == true);
+    TEST_ASSERT(c.size() < sizeof(data)/4);
+    TEST_ASSERT(c.data()[0] == (CompressionLZF | (2 << 2)));
+    TEST_ASSERT(Compressor::decompress(c.data(), c.size(), out, sizeof(out), n) == true);
+    TEST_ASSERT(n == sizeof(data) && memcmp(data, out, n) == 0);
+
+    TEST_ASSERT(c.compress((const uint8_t*)"AB", 2) == true);
+    TEST_ASSERT(c.size() == 3 && c.data()[0] == CompressionStored);
+    TEST_ASSERT(Compressor::decompress(c.data(), c.size(), out, sizeof(out), n) == true);
+    TEST_ASSERT(n == 2 && out[0] == 'A' && out[1] == 'B');
+}
+
+// messages to the same destination share one datagram
+void testCoalescing() {
+    modem.reset();
+    nb.setCoalescing(true, 60000);
+
+    TEST_ASSERT(nb.sendUDP("10.0.0.1", 9876, "AB") == true);
+    TEST_ASSERT(nb.sendUDP("10.0.0.1", 9876, "C") == true);
+
+    // another destination sends the pending datagram first
+    modem.addExchange("AT+NSOCR=DGRAM,17,*,0\r\n", "1\r\nOK\r\n");
+    modem.addExchange("AT+NSOST=1,10.0.0.1,9876,7,00024142000143\r\n", "1,7\r\nOK\r\n");
+    TEST_ASSERT(nb.sendUDP("10.0.0.2", 9876, "D") == true);
+
+    modem.addExchange("AT+NSOST=1,10.0.0.2,9876,6,000144000145\r\n", "1,6\r\nOK\r\n");
+    TEST_ASSERT(nb.sendUDP("10.0.0.2", 9876, "E", SendFlush) == true);
+
+    // nothing pending
+    TEST_ASSERT(nb.flush() == true);
+
+    nb.setCoalescing(false);
+    modem.addExchange("AT+NSOCL=1\r\n", "OK\r\n");
+    nb.closeSockets();
+}
+
+// records wrap around the end of the store and come out in order
+void testOutbox() {
+    static uint8_t buf[32];
+    RAMOutboxStore store(buf, sizeof(buf));
+    Outbox ob(store);
+
+    string addr;
+    unsigned int port = 0;
+    uint8_t data[8];
+    size_t len = 0;
+    int options = 0;
+
+    // 6 header + 8 address + 2 payload
+    TEST_ASSERT(ob.push("10.0.0.1", 1000, (const uint8_t*)"AB", 2, SendDefault) == true);
+    TEST_ASSERT(ob.push("10.0.0.1", 1001, (const uint8_t*)"CD", 2, SendReleaseAfterUplink) == true);
+    TEST_ASSERT(ob.push("10.0.0.1", 1002, (const uint8_t*)"EF", 2, SendDefault) == false);
+    TEST_ASSERT(ob.rejected() == 1);
+
+    TEST_ASSERT(ob.pop() == true);
+    TEST_ASSERT(ob.push("10.0.0.1", 1002, (const uint8_t*)"EF", 2, SendDefault) == true);
+    TEST_ASSERT(ob.count() == 2);
+
+    TEST_ASSERT(ob.peek(addr, port, data, sizeof(data), len, options) == true);
+    TEST_ASSERT(port == 1001 && len == 2 && options == SendReleaseAfterUplink && memcmp(data, "CD", 2) == 0);
+    TEST_ASSERT(ob.pop() == true);
+    TEST_ASSERT(ob.peek(addr, port, data, sizeof(data), len, options) == true);
+    TEST_ASSERT(addr == "10.0.0.1" && port == 1002 && len == 2 && memcmp(data, "EF", 2) == 0);
+    TEST_ASSERT(ob.pop() == true);
+    TEST_ASSERT(ob.empty() == true && ob.used() == 0);
+}
+
+// datagrams that cannot be sent wait in the outbox until attached
+void testSendViaOutbox() {
+    static uint8_t buf[256];
+    RAMOutboxStore store(buf, sizeof(buf));
+    Outbox ob(store);
+
+    modem.reset();
+    nb.setOutbox(&ob);
+
+    // searching as per +CEREG, queued without asking the modem
+    RegistrationNotifications& rn = nbc.registrationNotifications();
+    rn.update(2);
+    uint64_t t0 = Kernel::get_ms_count();
+    TEST_ASSERT(nb.sendUDP("10.0.0.1", 9876, "AB") == true);
+    TEST_ASSERT(nb.sendUDP("10.0.0.1", 9876, "CD") == true);
+    TEST_ASSERT(Kernel::get_ms_count()-t0 < 100);
+    TEST_ASSERT(ob.count() == 2);
+
+    TEST_ASSERT(nb.drainOutbox() == false);
+    TEST_ASSERT(ob.count() == 2);
+
+    rn.update(1);
+    modem.addExchange("AT+NSOCR=DGRAM,17,*,0\r\n", "1\r\nOK\r\n");
+    modem.addExchange("AT+NSOST=1,10.0.0.1,9876,2,4142\r\n", "1,2\r\nOK\r\n");
+    modem.addExchange("AT+NSOST=1,10.0.0.1,9876,2,4344\r\n", "1,2\r\nOK\r\n");
+    TEST_ASSERT(nb.drainOutbox() == true);
+    TEST_ASSERT(ob.empty() == true);
+
+    // status unknown, a failed send is queued
+    rn.reset();
+    modem.addExchange("AT+NSOST=1,10.0.0.1,9876,2,4546\r\n", "ERROR\r\n");
+    modem.addExchange("AT+NSOCL=1\r\n", "OK\r\n");
+    modem.addExchange("AT+NSOCR=DGRAM,17,*,0\r\n", "ERROR\r\n");
+    TEST_ASSERT(nb.sendUDP("10.0.0.1", 9876, "EF") == true);
+    TEST_ASSERT(ob.count() == 1);
+    ob.pop();
+
+    nb.setOutbox(NULL);
+    nb.closeSockets();
+}
+
+static volatile int attach_cb_calls = 0;
+static volatile bool attach_cb_result = false;
+
+static void on_attach(bool b_attached, unsigned long) {
+    attach_cb_calls++;
+    attach_cb_result = b_attached;
+}
+
+// attach completes on the +CEREG URC, not by polling AT+CGATT?
+void testEventDrivenAttach() {
+    modem.reset();
+    modem.addExchange("AT+CEREG=2\r\n", "OK\r\n");
+    modem.addExchange("AT+CGATT=1\r\n", "OK\r\n");
+    modem.addExchange("AT+CEREG?\r\n", "+CEREG:2,2\r\nOK\r\n");
+    modem.addExchange("", "+CEREG:1,\"0001\",\"00ABCDEF\",7\r\n");
+
+    TEST_ASSERT(nb.startAttach(callback(on_attach)) == true);
+    TEST_ASSERT(nb.waitForAttach(TIMEOUT) == true);
+    TEST_ASSERT(attach_cb_calls == 1 && attach_cb_result == true);
+    TEST_ASSERT(nbc.registrationNotifications().status() == 1);
+
+    // responses to the query are not taken as URC
+    modem.addExchange("AT+CEREG?\r\n", "+CEREG:2,1,\"0001\",\"00ABCDEF\",7\r\nOK\r\n");
+    int status = -1;
+    TEST_ASSERT(nbc.networkRegistrationStatus().get(status) == true && status == 1);
+    TEST_ASSERT(attach_cb_calls == 1);
+}
+
+static RegistrationNotifications *p_rn_reentrant = NULL;
+static volatile int rn_cb_calls = 0;
+
+static void on_status_reentrant(int status) {
+    rn_cb_calls++;
+    // the same status arriving while the callback runs, as a query
+    // racing a +CEREG URC
+    if ( rn_cb_calls < 3) {
+        p_rn_reentrant->update(status);
+    }
+}
+
+// a status change is notified once, however many times it is reported
+void testRegistrationNotifyOnce() {
+    RegistrationNotifications rn;
+    p_rn_reentrant = &rn;
+    rn_cb_calls = 0;
+    rn.onChange(callback(on_status_reentrant));
+
+    rn.update(1);
+    TEST_ASSERT(rn_cb_calls == 1 && rn.status() == 1);
+    rn.update(1);
+    TEST_ASSERT(rn_cb_calls == 1);
+    rn.update(2);
+    TEST_ASSERT(rn_cb_calls == 2 && rn.status() == 2);
+    rn.onChange(Callback<void(int)>());
+}
+
+// boot probes readiness, then runs the init commands back to back
+void testBoot() {
+    modem.reset();
+    modem.addExchange("AT\r\n", "ERROR\r\n");
+    modem.addExchange("AT\r\n", "OK\r\n");
+    modem.addExchange("AT+CMEE=1\r\n", "OK\r\n");
+    modem.addExchange("ATE=0\r\n", "OK\r\n");
+    modem.addExchange("AT+CFUN=1\r\n", "OK\r\n");
+    modem.addExchange("AT+CEREG=2\r\n", "OK\r\n");
+    modem.addExchange("AT+CGATT=1\r\n", "OK\r\n");
+    modem.addExchange("AT+CEREG?\r\n", "+CEREG:2,1\r\nOK\r\n");
+
+    TEST_ASSERT(nb.boot() == true);
+    TEST_ASSERT(nb.waitForAttach(TIMEOUT) == true);
+
+    const BootTimings& bt = nb.bootTimings();
+    TEST_ASSERT(bt.probes == 2);
+    TEST_ASSERT(bt.ready >= Narrowband::Narrowband::boot_probe_interval);
+    TEST_ASSERT(bt.ready <= bt.error_reporting && bt.error_reporting <= bt.echo_off);
+    TEST_ASSERT(bt.echo_off <= bt.functionality && bt.functionality <= bt.attach_started);
+    TEST_ASSERT(bt.first_packet == 0);
+}
+
+// configure only writes settings that differ from the modem's
+void testConfigureDiff() {
+    modem.reset();
+
+    NarrowbandConfig cfg;
+    cfg.echo_on.enable();
+    cfg.echo_on.set(false);
+    cfg.bands.enable();
+    cfg.bands.get().push_back(8);
+    cfg.bands.get().push_back(20);
+    cfg.ops_mode.enable();
+    cfg.ops_mode.set(Automatic);
+
+    // echo was turned off by boot()
+    modem.addExchange("AT+NBAND?\r\n", "+NBAND:20,8\r\nOK\r\n");
+    modem.addExchange("AT+COPS?\r\n", "+COPS:0\r\nOK\r\n");
+    ConfigureResult res;
+    TEST_ASSERT(nb.configure(cfg, res) == true);
+    TEST_ASSERT(res.changed == 0 && res.failed == 0 && res.b_reboot_required == false);
+
+    cfg.bands.get().pop_back();
+    cfg.ops_mode.set(Manual);
+    cfg.ops_name.enable();
+    cfg.ops_name.set("26201");
+    modem.addExchange("AT+NBAND?\r\n", "+NBAND:20,8\r\nOK\r\n");
+    modem.addExchange("AT+NBAND=8\r\n", "OK\r\n");
+    modem.addExchange("AT+COPS?\r\n", "+COPS:0\r\nOK\r\n");
+    modem.addExchange("AT+COPS=1,2,\"26201\"\r\n", "OK\r\n");
+    TEST_ASSERT(nb.configure(cfg, res) == true);
+    TEST_ASSERT(res.changed == (ConfigBands | ConfigOperator) && res.b_reboot_required == true);
+}
+
+// staged NCONFIG writes go out in one pass without re-reading
+void testNConfigCommit() {
+    modem.reset();
+    NConfigControl ncc = nbc.nconfig();
+
+    modem.addExchange("AT+NCONFIG?\r\n", "+NCONFIG:AUTOCONNECT,TRUE\r\n+NCONFIG:CELL_RESELECTION,FALSE\r\nOK\r\n");
+    TEST_ASSERT(ncc.get() == true);
+
+    ncc.stage("AUTOCONNECT", "TRUE");
+    ncc.stage("CELL_RESELECTION", "TRUE");
+    ncc.stage("COMBINE_ATTACH", "FALSE");
+    modem.addExchange("AT+NCONFIG=CELL_RESELECTION,TRUE\r\n", "OK\r\n");
+    modem.addExchange("AT+NCONFIG=COMBINE_ATTACH,FALSE\r\n", "ERROR\r\n");
+    TEST_ASSERT(ncc.commit() == false);
+
+    list<NConfigWrite>::const_iterator it = ncc.writes().begin();
+    TEST_ASSERT((it++)->status == NConfigUnchanged);
+    TEST_ASSERT((it++)->status == NConfigWritten);
+    TEST_ASSERT((it++)->status == NConfigFailed);
+    TEST_ASSERT(ncc.valueFor("CELL_RESELECTION") == "TRUE");
+    const NConfigControl& cncc = ncc;
+    TEST_ASSERT(cncc.get().count("COMBINE_ATTACH") == 0);
+    ncc.discard();
+
+    // a successful commit clears the staged writes
+    ncc.stage("COMBINE_ATTACH", "FALSE");
+    modem.addExchange("AT+NCONFIG=COMBINE_ATTACH,FALSE\r\n", "OK\r\n");
+    TEST_ASSERT(ncc.commit() == true);
+    TEST_ASSERT(ncc.writes().empty() == true);
+
+    // nothing left to send
+    uint64_t t0 = Kernel::get_ms_count();
+    TEST_ASSERT(ncc.commit() == true);
+    TEST_ASSERT(Kernel::get_ms_count()-t0 < 100);
+}
+
+// status is collected in one concatenated command line if possible
+void testModemStatus() {
+    modem.reset();
+    ModemStatus st;
+
+    modem.addExchange("AT+CSQ;+CEREG?;+CSCON?;+CGATT?;+CGACT?\r\n",
+        "+CSQ:21,99\r\n+CEREG:0,1\r\n+CSCON:0,1\r\n+CGATT:1\r\n+CGACT:0,0\r\n+CGACT:1,1\r\nOK\r\n");
+    TEST_ASSERT(nbc.status(st) == true);
+    TEST_ASSERT(st.round_trips == 1 && st.timestamp > 0);
+    TEST_ASSERT(st.rssi == 21 && st.ber == 99 && st.registration == 1);
+    TEST_ASSERT(st.connection == 1 && st.attached == 1 && st.pdp_active == 1);
+
+    // falls back to single commands if the modem rejects the line
+    NarrowbandCore core(mca);
+    modem.addExchange("AT+CSQ;+CEREG?;+CSCON?;+CGATT?;+CGACT?\r\n", "ERROR\r\n");
+    modem.addExchange("AT+CSQ\r\n", "+CSQ:5,99\r\nOK\r\n");
+    modem.addExchange("AT+CEREG?\r\n", "+CEREG:0,2\r\nOK\r\n");
+    modem.addExchange("AT+CSCON?\r\n", "+CSCON:0,0\r\nOK\r\n");
+    modem.addExchange("AT+CGATT?\r\n", "+CGATT:0\r\nOK\r\n");
+    modem.addExchange("AT+CGACT?\r\n", "OK\r\n");
+    TEST_ASSERT(core.status(st) == true);
+    TEST_ASSERT(st.round_trips == 6 && st.rssi == 5 && st.registration == 2);
+    TEST_ASSERT(st.connection == 0 && st.attached == 0 && st.pdp_active == 0);
+}
+
+// AT+NUESTATS output goes into typed structs
+void testNUEStats() {
+    modem.reset();
+    NUEStatsControl ns = nbc.nueStats();
+
+    NUEStatsRadio radio;
+    memset(&radio, 0, sizeof(radio));
+    modem.addExchange("AT+NUESTATS=RADIO\r\n",
+        "NUESTATS:RADIO,Signal power,-1047\r\nNUESTATS:RADIO,TX power,230\r\n"
+        "NUESTATS:RADIO,TX time,1234\r\nNUESTATS:RADIO,ECL,1\r\nNUESTATS:RADIO,SNR,-32\r\nOK\r\n");
+    TEST_ASSERT(ns.getRadio(radio) == true);
+    TEST_ASSERT(radio.signal_power == -1047 && radio.tx_power == 230 && radio.tx_time == 1234);
+    TEST_ASSERT(radio.ecl == 1 && radio.snr == -32 && radio.rsrq == 0);
+
+    NUEStatsCell cells[2];
+    size_t n = 0;
+    modem.addExchange("AT+NUESTATS=CELL\r\n",
+        "NUESTATS:CELL,3686,21,1,-594,-68,-525,196\r\nNUESTATS:CELL,3686,450,0,-1101,-211,-1007,-42\r\n"
+        "NUESTATS:CELL,3686,451,0,-1103,-212,-1009,-43\r\nOK\r\n");
+    TEST_ASSERT(ns.getCells(cells, 2, n) == true && n == 2);
+    TEST_ASSERT(cells[0].pci == 21 && cells[0].primary == 1 && cells[0].snr == 196);
+    TEST_ASSERT(cells[1].rsrp == -1101 && cells[1].rssi == -1007);
+
+    NUEStatsTHP thp;
+    memset(&thp, 0, sizeof(thp));
+    modem.addExchange("AT+NUESTATS=THP\r\n", "NUESTATS:THP,RLC UL,1520\r\nNUESTATS:THP,MAC DL,88\r\nOK\r\n");
+    TEST_ASSERT(ns.getThroughput(thp) == true && thp.rlc_ul == 1520 && thp.mac_dl == 88);
+
+    // samples are kept newest first
+    for ( int i = 0; i < 3; i++) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "NUESTATS:RADIO,ECL,%d\r\nOK\r\n", i);
+        modem.addExchange("AT+NUESTATS=RADIO\r\n", buf);
+        TEST_ASSERT(nb.sampleRadio() == true);
+    }
+    RadioSample rs;
+    TEST_ASSERT(nb.radioSampleCount() == 3);
+    TEST_ASSERT(nb.radioSample(0, rs) == true && rs.radio.ecl == 2);
+    TEST_ASSERT(nb.radioSample(2, rs) == true && rs.radio.ecl == 0);
+    TEST_ASSERT(nb.radioSample(3, rs) == false);
+}
+
+// non-urgent datagrams wait in the outbox while coverage is poor
+void testCoverageDeferral() {
+    static uint8_t buf[256];
+    RAMOutboxStore store(buf, sizeof(buf));
+    Outbox ob(store);
+
+    modem.reset();
+    CoveragePolicy policy;
+    policy.check_interval = 60000;
+    TEST_ASSERT(nb.setCoveragePolicy(policy) == false);
+    nb.setOutbox(&ob);
+    TEST_ASSERT(nb.setCoveragePolicy(policy) == true);
+
+    modem.addExchange("AT+CSQ\r\n", "+CSQ:99,99\r\nOK\r\n");
+    TEST_ASSERT(nb.sendUDP("10.0.0.1", 9876, "AB") == true);
+    TEST_ASSERT(nb.sendUDP("10.0.0.1", 9876, "CD") == true);
+    TEST_ASSERT(ob.count() == 2);
+
+    // urgent ones go out right away
+    modem.addExchange("AT+NSOCR=DGRAM,17,*,0\r\n", "1\r\nOK\r\n");
+    modem.addExchange("AT+NSOST=1,10.0.0.1,9876,2,4546\r\n", "1,2\r\nOK\r\n");
+    TEST_ASSERT(nb.sendUDP("10.0.0.1", 9876, "EF", SendUrgent) == true);
+    TEST_ASSERT(ob.count() == 2);
+
+    // coverage is read again and found good
+    policy.check_interval = 0;
+    nb.setCoveragePolicy(policy);
+    modem.addExchange("AT+CSQ\r\n", "+CSQ:20,99\r\nOK\r\n");
+    modem.addExchange("AT+NUESTATS=RADIO\r\n", "NUESTATS:RADIO,ECL,0\r\nOK\r\n");
+    modem.addExchange("AT+NSOST=1,10.0.0.1,9876,2,4142\r\n", "1,2\r\nOK\r\n");
+    modem.addExchange("AT+NSOST=1,10.0.0.1,9876,2,4344\r\n", "1,2\r\nOK\r\n");
+    TEST_ASSERT(nb.drainOutbox() == true);
+    TEST_ASSERT(ob.empty() == true);
+
+    const DeferralStats& ds = nb.deferralStats();
+    TEST_ASSERT(ds.deferred == 2 && ds.flushed == 2 && ds.forced == 0);
+    TEST_ASSERT(ds.checks == 2 && ds.poor == 1 && ds.last_rssi == 20 && ds.last_ecl == 0);
+
+    nb.clearCoveragePolicy();
+    nb.setOutbox(NULL);
+    modem.addExchange("AT+NSOCL=1\r\n", "OK\r\n");
+    nb.closeSockets();
+}
+
+// datagrams of the peer come through, others are dropped
+void testUDPSocketTransport() {
+    modem.reset();
+
+    UDPSocketControl sc = nbc.udp();
+    sc.setReceiveControl(true);
+    modem.addExchange("AT+NSOCR=DGRAM,17,*,1\r\n", "0\r\nOK\r\n");
+    TEST_ASSERT(sc.open() == true);
+
+    UDPSocketTransport t(sc, "10.0.0.1", 5683);
+    modem.addExchange("AT+NSOST=0,10.0.0.1,5683,2,4142\r\n", "0,2\r\nOK\r\n");
+    TEST_ASSERT(t.send((const uint8_t*)"AB", 2) == true);
+
+    uint8_t buf[8];
+    size_t len = 0;
+    modem.addExchange("", "+NSONMI:0,5\r\n");
+    modem.addExchange("AT+NSORF=0,8\r\n", "0,10.0.0.2,5683,3,010203,0\r\nOK\r\n");
+    modem.addExchange("AT+NSORF=0,8\r\n", "0,10.0.0.1,5683,2,CAFE,0\r\nOK\r\n");
+    TEST_ASSERT(t.receive(buf, sizeof(buf), len, TIMEOUT) == true);
+    TEST_ASSERT(len == 2 && buf[0] == 0xCA && buf[1] == 0xFE);
+    TEST_ASSERT(t.receive(buf, sizeof(buf), len, 100) == false);
+
+    // a notification with nothing to read does not end the wait
+    modem.addExchange("", "+NSONMI:0,4\r\n");
+    modem.addExchange("AT+NSORF=0,8\r\n", "OK\r\n");
+    modem.addExchange("", "+NSONMI:0,2\r\n");
+    modem.addExchange("AT+NSORF=0,8\r\n", "0,10.0.0.1,5683,2,BEEF,0\r\nOK\r\n");
+    TEST_ASSERT(t.receive(buf, sizeof(buf), len, TIMEOUT) == true);
+    TEST_ASSERT(len == 2 && buf[0] == 0xBE && buf[1] == 0xEF);
+
+    modem.addExchange("AT+NSOCL=0\r\n", "OK\r\n");
+    TEST_ASSERT(sc.close() == true);
+}
+
+// uplinks go to the attached modem with better coverage, fail over
+// when it rejects them
+void testModemPool() {
+    static MockSerial modem2;
+    static CommandAdapter<MockSerial> mca2(modem2);
+    static NarrowbandCore nbc2(mca2);
+    static Narrowband::Narrowband nb2(nbc2);
+
+    modem.reset();
+    nb.resetSockets();
+    modem.addRule("AT+CSQ;+CEREG?;+CSCON?;+CGATT?;+CGACT?\r\n", "+CSQ:5,99\r\n+CEREG:0,1\r\n+CGATT:1\r\nOK\r\n");
+    modem.addRule("AT+NSOCR=*\r\n", "1\r\nOK\r\n");
+    modem.addRule("AT+NSOST=1,*\r\n", "1,2\r\nOK\r\n");
+    modem2.addRule("AT+CSQ;+CEREG?;+CSCON?;+CGATT?;+CGACT?\r\n", "+CSQ:20,99\r\n+CEREG:0,1\r\n+CGATT:1\r\nOK\r\n");
+    modem2.addRule("AT+NSOCR=*\r\n", "0\r\nOK\r\n");
+    modem2.addRule("AT+NSOST=0,*\r\n", "0,2\r\nOK\r\n");
+
+    ModemPool pool;
+    TEST_ASSERT(pool.add(nb) == true);
+    TEST_ASSERT(pool.add(nb2) == true);
+    pool.poll();
+
+    PooledModemStats ms;
+    TEST_ASSERT(pool.modemStats(1, ms) == true);
+    TEST_ASSERT(ms.attached == 1 && ms.rssi == 20 && ms.b_healthy == true);
+
+    TEST_ASSERT(pool.sendUDP("10.0.0.1", 9876, "AB") == true);
+    TEST_ASSERT(pool.modemStats(1, ms) == true);
+    TEST_ASSERT(ms.sent == 1);
+
+    // modem 2 drops out
+    modem2.reset();
+    modem2.addRule("AT+NSOST=0,*\r\n", "ERROR\r\n");
+    modem2.addRule("AT+NSOCL=0\r\n", "OK\r\n");
+    modem2.addRule("AT+NSOCR=*\r\n", "ERROR\r\n");
+
+    TEST_ASSERT(pool.sendUDP("10.0.0.1", 9876, "CD") == true);
+    TEST_ASSERT(pool.modemStats(1, ms) == true);
+    TEST_ASSERT(ms.failed == 1 && ms.b_healthy == false);
+    TEST_ASSERT(pool.modemStats(0, ms) == true);
+    TEST_ASSERT(ms.sent == 1);
+
+    ModemPoolStats st;
+    pool.stats(st);
+    TEST_ASSERT(st.sent == 2 && st.failovers == 1 && st.failed == 0 && st.bytes == 4);
+
+    // skipped until healthy again
+    TEST_ASSERT(pool.sendUDP("10.0.0.1", 9876, "EF") == true);
+    TEST_ASSERT(pool.modemStats(0, ms) == true);
+    TEST_ASSERT(ms.sent == 2);
+
+    // too large for any modem, not held against one
+    TEST_ASSERT(pool.sendUDP("10.0.0.1", 9876, string(1400, 'x')) == false);
+    TEST_ASSERT(pool.modemStats(0, ms) == true);
+    TEST_ASSERT(ms.failed == 0 && ms.b_healthy == true);
+
+    // refused by the modem's outbox, no modem failure either
+    static uint8_t buf[32];
+    RAMOutboxStore store(buf, sizeof(buf));
+    Outbox ob(store);
+    nb.setOutbox(&ob);
+    nbc.registrationNotifications().update(2);
+    TEST_ASSERT(pool.sendUDP("10.0.0.1", 9876, string(64, 'x')) == false);
+    TEST_ASSERT(nb.sendError() == SendErrorRejected);
+    TEST_ASSERT(pool.modemStats(0, ms) == true);
+    TEST_ASSERT(ms.failed == 0 && ms.b_healthy == true);
+
+    // queued by a detached modem, which is skipped from now on
+    TEST_ASSERT(pool.sendUDP("10.0.0.1", 9876, "GH") == true);
+    TEST_ASSERT(nb.queued() == true && ob.count() == 1);
+    TEST_ASSERT(pool.modemStats(0, ms) == true);
+    TEST_ASSERT(ms.queued == 1 && ms.sent == 2 && ms.b_healthy == false);
+    TEST_ASSERT(pool.sendUDP("10.0.0.1", 9876, "IJ") == false);
+    ob.pop();
+    nb.setOutbox(NULL);
+    nbc.registrationNotifications().update(1);
+
+    pool.stats(st);
+    TEST_ASSERT(st.failed == 3 && st.rejected == 2 && st.failovers == 1 && st.queued == 1 && st.sent == 3);
+
+    modem.reset();
+    nb.resetSockets();
+}
+
+// module without AT+NSOSTF and AT+NUESTATS
+struct NoRAIProfile : public GenericProfile {
+    static const unsigned int commands = ModuleCommandChaining;
+};
+
+// a module profile limits payload and bands without asking the modem
+void testModuleProfile() {
+    modem.reset();
+    {
+        NarrowbandCoreFor<BC95Profile> core95(mca);
+        TEST_ASSERT(core95.profile().max_payload == 512);
+        TEST_ASSERT(core95.profile().supportsBand(8) == true);
+        TEST_ASSERT(core95.profile().supportsBand(20) == false);
+        TEST_ASSERT(core95.echo().readable() == false);
+        TEST_ASSERT(nbc.profile().supportsBand(20) == true);
+
+        Narrowband::Narrowband nb95(core95);
+        NarrowbandConfig c;
+        list<int> b;
+        b.push_back(20);
+        c.bands.set(b);
+        c.bands.enable();
+        ConfigureResult res;
+        uint64_t t0 = Kernel::get_ms_count();
+        TEST_ASSERT(nb95.configure(c, res) == false);
+        TEST_ASSERT(res.failed == ConfigBands && res.changed == 0);
+        TEST_ASSERT(nb95.sendUDP("10.0.0.1", 9876, string(600, 'x')) == false);
+        TEST_ASSERT(Kernel::get_ms_count()-t0 < 100);
+    }
+    {
+        NarrowbandCoreFor<NoRAIProfile> core(mca);
+        Narrowband::Narrowband nbp(core);
+        uint64_t t0 = Kernel::get_ms_count();
+        TEST_ASSERT(nbp.sampleRadio() == false);
+        TEST_ASSERT(Kernel::get_ms_count()-t0 < 100);
+
+        // RAI is dropped instead of failing the send
+        modem.addExchange("AT+NSOCR=DGRAM,17,*,0\r\n", "0\r\nOK\r\n");
+        modem.addExchange("AT+NSOST=0,10.0.0.1,9876,2,4142\r\n", "0,2\r\nOK\r\n");
+        TEST_ASSERT(nbp.sendUDP("10.0.0.1", 9876, "AB", SendReleaseAfterUplink) == true);
+
+        // coverage from AT+CSQ alone, ECL is not asked for
+        static uint8_t buf[64];
+        RAMOutboxStore store(buf, sizeof(buf));
+        Outbox ob(store);
+        nbp.setOutbox(&ob);
+        CoveragePolicy policy;
+        TEST_ASSERT(nbp.setCoveragePolicy(policy) == true);
+        modem.addExchange("AT+CSQ\r\n", "+CSQ:20,99\r\nOK\r\n");
+        modem.addExchange("AT+NSOST=0,10.0.0.1,9876,2,4344\r\n", "0,2\r\nOK\r\n");
+        t0 = Kernel::get_ms_count();
+        TEST_ASSERT(nbp.sendUDP("10.0.0.1", 9876, "CD") == true);
+        TEST_ASSERT(Kernel::get_ms_count()-t0 < 100);
+        TEST_ASSERT(ob.empty() == true && nbp.deferralStats().last_ecl == -1);
+        nbp.setOutbox(NULL);
+        modem.addExchange("AT+NSOCL=0\r\n", "OK\r\n");
+        nbp.closeSockets();
+    }
+    modem.reset();
+}
+
+// adaptive timeouts follow the latency of each verb
+void testAdaptiveTimeouts() {
+    modem.reset();
+    modem.setLatency(40);
+    modem.addRule("AT+CSQ\r\n", "+CSQ:20,99\r\nOK\r\n");
+    mca.setAdaptiveTimeouts(true, 100, 2000);
+
+    ModemResponse r;
+    for ( int i = 0; i < 5; i++) {
+        TEST_ASSERT(mca.send("AT+CSQ", r, TIMEOUT) == true);
+    }
+    CommandTiming t;
+    TEST_ASSERT(mca.commandTiming("AT+CSQ", t) == true);
+    TEST_ASSERT(t.samples == 5 && t.timeouts == 0);
+    TEST_ASSERT(t.srtt >= 40 && t.srtt < 100);
+    TEST_ASSERT(t.rto >= 100 && t.rto <= 2000);
+    TEST_ASSERT(mca.commandTiming("AT+CGATT?", t) == false);
+
+    // a dead modem is given up on long before the fixed timeout
+    modem.reset();
+    TEST_ASSERT(mca.commandTiming("AT+CSQ", t) == true);
+    unsigned long rto = t.rto;
+    unsigned long window = mca.lateResponseWindow();
+    mca.lateResponseWindow() = 100;
+    uint64_t t0 = Kernel::get_ms_count();
+    TEST_ASSERT(mca.send("AT+CSQ", r, 5000) == false);
+    TEST_ASSERT(Kernel::get_ms_count()-t0 < 1000);
+    mca.lateResponseWindow() = window;
+    TEST_ASSERT(mca.commandTiming("AT+CSQ", t) == true);
+    TEST_ASSERT(t.timeouts == 1 && t.rto == 2*rto);
+
+    // a slow write is not held to the timeout learned from fast queries
+    modem.reset();
+    modem.setLatency(10);
+    modem.addRule("AT+CGATT?\r\n", "+CGATT:1\r\nOK\r\n");
+    for ( int i = 0; i < 5; i++) {
+        TEST_ASSERT(mca.send("AT+CGATT?", r, TIMEOUT) == true);
+    }
+    TEST_ASSERT(mca.commandTiming("AT+CGATT?", t) == true);
+    TEST_ASSERT(t.samples == 5 && t.rto < 300);
+    TEST_ASSERT(mca.commandTiming("AT+CGATT=1", t) == false);
+    modem.setLatency(300);
+    modem.addExchange("AT+CGATT=1\r\n", "OK\r\n");
+    TEST_ASSERT(mca.send("AT+CGATT=1", r, TIMEOUT) == true);
+    TEST_ASSERT(r.isOk() == true);
+    TEST_ASSERT(mca.commandTiming("AT+CGATT=0", t) == true);
+    TEST_ASSERT(t.samples == 1 && t.timeouts == 0 && t.srtt >= 300);
+    TEST_ASSERT(mca.commandTiming("AT+CGATT?", t) == true);
+    TEST_ASSERT(t.samples == 5 && t.timeouts == 0);
+
+    mca.setAdaptiveTimeouts(false);
+    modem.reset();
+}
+
+// transient +CME ERRORs are retried, permanent ones are not
+void testRetryingAdapter() {
+    modem.reset();
+    RetryPolicy policy;
+    policy.base_delay = 10;
+    policy.max_delay = 40;
+    RetryingCommandAdapter rca(mca, policy);
+
+    TEST_ASSERT(RetryingCommandAdapter::isTransient(159) == true);
+    TEST_ASSERT(RetryingCommandAdapter::isTransient(3) == false);
+    TEST_ASSERT(RetryingCommandAdapter::isTransient(0) == false);
+
+    ModemResponse r;
+    modem.addExchange("AT+CGATT=1\r\n", "+CME ERROR: 159\r\n");
+    modem.addExchange("AT+CGATT=1\r\n", "OK\r\n");
+    TEST_ASSERT(rca.send("AT+CGATT=1", r, TIMEOUT) == true);
+    TEST_ASSERT(r.isOk() == true);
+
+    modem.addExchange("AT+CGATT=1\r\n", "+CME ERROR: 3\r\n");
+    TEST_ASSERT(rca.send("AT+CGATT=1", r, TIMEOUT) == true);
+    TEST_ASSERT(r.hasError() == true && r.getErrCode() == 3);
+
+    for ( int i = 0; i < 4; i++) {
+        modem.addExchange("AT+NSOST=0,10.0.0.1,9876,2,4142\r\n", "+CME ERROR: 159\r\n");
+    }
+    const uint8_t ab[] = { 'A', 'B' };
+    TEST_ASSERT(rca.sendPayload("AT+NSOST=0,10.0.0.1,9876,2,", ab, 2, r, TIMEOUT) == true);
+    TEST_ASSERT(r.hasError() == true && r.getErrCode() == 159);
+
+    RetryStats st;
+    TEST_ASSERT(rca.retryStats("AT+CGATT=0", st) == true);
+    TEST_ASSERT(st.commands == 2 && st.retries == 1 && st.recovered == 1 && st.permanent == 1 && st.gave_up == 0);
+    TEST_ASSERT(rca.retryStats("AT+NSOST=", st) == true);
+    TEST_ASSERT(st.commands == 1 && st.retries == 3 && st.gave_up == 1);
+    rca.totalStats(st);
+    TEST_ASSERT(st.commands == 3 && st.retries == 4);
+    TEST_ASSERT(rca.retryStats("AT+CSQ", st) == false);
+
+    // without retries a transient error is given up right away
+    policy.max_retries = 0;
+    RetryingCommandAdapter rca0(mca, policy);
+    modem.addExchange("AT+CGATT=1\r\n", "+CME ERROR: 159\r\n");
+    TEST_ASSERT(rca0.send("AT+CGATT=1", r, TIMEOUT) == true);
+    TEST_ASSERT(rca0.retryStats("AT+CGATT=", st) == true);
+    TEST_ASSERT(rca0.retryStats("AT+CGATT?", st) == false);
+    TEST_ASSERT(st.commands == 1 && st.retries == 0 && st.gave_up == 1 && st.permanent == 0);
+    modem.reset();
+}
+
+// lines longer than the old 256 char buffer arrive in one piece
+void testLongResponseLine() {
+    modem.reset();
+    string data(500, 'A');
+    modem.addExchange("AT+UNITTEST\r\n", "+DATA:"+data+"\r\nOK\r\n");
+
+    ModemResponse r;
+    TEST_ASSERT(mca.send("AT+UNITTEST", r, TIMEOUT) == true);
+    string v;
+    TEST_ASSERT(r.isOk() == true);
+    TEST_ASSERT(r.getCommandResponse("+DATA", v) == true);
+    TEST_ASSERT(v == data);
+    TEST_ASSERT(mca.rxOverruns() == 0);
+    modem.reset();
+}
+
+// sends one command from its own thread at a priority
+class PrioritySender {
+public:
+    PrioritySender(CommandPriority p, const char *p_cmd) : b_ok(false), done(0), _p(p), _p_cmd(p_cmd) { }
+    void start() { _thread.start(callback(this, &PrioritySender::run)); }
+    void join() { _thread.join(); }
+
+    bool        b_ok;
+    uint64_t    done;
+private:
+    void run() {
+        mca.setCommandPriority(_p);
+        ModemResponse r;
+        b_ok = mca.send(_p_cmd, r, 2000) && r.isOk();
+        done = Kernel::get_ms_count();
+        mca.setCommandPriority(PriorityNormal);
+    }
+
+    CommandPriority _p;
+    const char      *_p_cmd;
+    Thread          _thread;
+};
+
+// an urgent command overtakes a background command waiting before it
+void testCommandPriorities() {
+    modem.reset();
+    modem.setLatency(100);
+    modem.addRule("AT+CSQ\r\n", "+CSQ:20,99\r\nOK\r\n");
+    modem.addRule("AT+NCONFIG?\r\n", "OK\r\n");
+    modem.addRule("AT+CGATT?\r\n", "+CGATT:1\r\nOK\r\n");
+    mca.resetPriorityStats();
+
+    PrioritySender poll(PriorityBackground, "AT+CSQ");
+    PrioritySender dump(PriorityBackground, "AT+NCONFIG?");
+    PrioritySender alarm(PriorityUrgent, "AT+CGATT?");
+    poll.start();
+    wait_ms(20);
+    dump.start();
+    wait_ms(20);
+    alarm.start();
+    poll.join();
+    dump.join();
+    alarm.join();
+
+    TEST_ASSERT(poll.b_ok && dump.b_ok && alarm.b_ok);
+    TEST_ASSERT(poll.done < alarm.done && alarm.done < dump.done);
+
+    PriorityStats ps;
+    TEST_ASSERT(mca.priorityStats(PriorityUrgent, ps) == true);
+    TEST_ASSERT(ps.commands == 1 && ps.waited == 1 && ps.max_wait >= 40);
+    TEST_ASSERT(mca.priorityStats(PriorityBackground, ps) == true);
+    TEST_ASSERT(ps.commands == 2 && ps.waited == 1 && ps.max_wait >= 150);
+    TEST_ASSERT(ps.timeouts == 0);
+
+    // time spent waiting for the adapter counts toward the timeout
+    PrioritySender busy(PriorityNormal, "AT+CSQ");
+    busy.start();
+    wait_ms(20);
+    ModemResponse r;
+    uint64_t t0 = Kernel::get_ms_count();
+    TEST_ASSERT(mca.send("AT+CGATT?", r, 150) == false);
+    TEST_ASSERT(Kernel::get_ms_count()-t0 < 180);
+    busy.join();
+    TEST_ASSERT(busy.b_ok == true);
+    wait_ms(200);
+    modem.reset();
+}
+
+// the late response of a timed out command is not taken for the next one
+void testLateResponseDropped() {
+    modem.reset();
+    modem.setLatency(300);
+    modem.addRule("AT+CGMI\r\n", "Quectel\r\nOK\r\n");
+    modem.addRule("AT+CGMR\r\n", "+CGMR:V150\r\nOK\r\n");
+
+    CorrelationStats before, after;
+    mca.correlationStats(before);
+
+    ModemResponse r;
+    TEST_ASSERT(mca.send("AT+CGMI", r, 100) == false);
+    TEST_ASSERT(mca.send("AT+CGMR", r, TIMEOUT) == true);
+    string v;
+    TEST_ASSERT(r.getCommandResponse("+CGMR", v) == true && v == "V150");
+    TEST_ASSERT(r.getResponses().size() == 0);
+
+    mca.correlationStats(after);
+    TEST_ASSERT(after.abandoned == before.abandoned+1);
+    TEST_ASSERT(after.late_dropped == before.late_dropped+1);
+
+    // cancel wakes the sender right away
+    PrioritySender sender(PriorityNormal, "AT+CGMI");
+    uint64_t t0 = Kernel::get_ms_count();
+    sender.start();
+    wait_ms(50);
+    TEST_ASSERT(mca.cancel() == true);
+    sender.join();
+    TEST_ASSERT(sender.b_ok == false && sender.done-t0 < 250);
+    TEST_ASSERT(mca.send("AT+CGMR", r, TIMEOUT) == true);
+    TEST_ASSERT(r.getCommandResponse("+CGMR", v) == true && r.getResponses().size() == 0);
+    TEST_ASSERT(mca.cancel() == false);
+
+    mca.correlationStats(after);
+    TEST_ASSERT(after.cancelled == before.cancelled+1);
+    TEST_ASSERT(after.late_dropped == before.late_dropped+2);
+
+    // waiting for the late response is bounded by the next command's timeout
+    TEST_ASSERT(mca.send("AT+CGMI", r, 100) == false);
+    t0 = Kernel::get_ms_count();
+    TEST_ASSERT(mca.send("AT+CGMR", r, 50) == false);
+    TEST_ASSERT(Kernel::get_ms_count()-t0 < 100);
+
+    // and it is dropped when it comes after the window, if nothing was sent since
+    wait_ms(300);
+    unsigned long window = mca.lateResponseWindow();
+    mca.lateResponseWindow() = 50;
+    TEST_ASSERT(mca.send("AT+CGMI", r, 100) == false);
+    mca.lateResponseWindow() = window;
+    wait_ms(300);
+    TEST_ASSERT(mca.send("AT+CGMR", r, TIMEOUT) == true);
+    TEST_ASSERT(r.getCommandResponse("+CGMR", v) == true && r.getResponses().size() == 0);
+
+    mca.correlationStats(after);
+    TEST_ASSERT(after.abandoned == before.abandoned+4);
+    TEST_ASSERT(after.late_dropped == before.late_dropped+4);
+    TEST_ASSERT(after.drains_expired == before.drains_expired);
+    modem.reset();
+}
+
+// with compression, the header byte must still fit the datagram
+void testCompressionBoundary() {
+    modem.reset();
+    static Compressor c(0);
+    NarrowbandCoreFor<BC95Profile> core95(mca);
+    Narrowband::Narrowband nb95(core95);
+    nb95.setCompressor(&c);
+
+    // incompressible, stored with a header byte
+    string data;
+    uint32_t x = 12345;
+    for ( size_t i = 0; i < core95.profile().max_payload; i++) {
+        x = x*1103515245+12345;
+        data.push_back((char)(x >> 16));
+    }
+
+    uint64_t t0 = Kernel::get_ms_count();
+    TEST_ASSERT(nb95.sendUDP("10.0.0.1", 9876, data) == false);
+    TEST_ASSERT(Kernel::get_ms_count()-t0 < 100);
+
+    modem.addExchange("AT+NSOCR=DGRAM,17,*,0\r\n", "0\r\nOK\r\n");
+    modem.addExchange("AT+NSOST=0,10.0.0.1,9876,512,00*\r\n", "0,512\r\nOK\r\n");
+    modem.addExchange("AT+NSOCL=0\r\n", "OK\r\n");
+    TEST_ASSERT(nb95.sendUDP("10.0.0.1", 9876, data.substr(0, data.length()-1)) == true);
+    nb95.closeSockets();
+    modem.reset();
+}
+
 int main() {
     wait(1);
 
@@ -98,6 +1075,32 @@ int main() {
     testOkCmdResponse();
     testErr();
     testErrCode();
+    testUDPSocketReuse();
+    testUDPRecvFrom();
+    testHexCodec();
+    testSendPayload();
+    testUDPSendBatch();
+    testCompression();
+    testCoalescing();
+    testOutbox();
+    testSendViaOutbox();
+    testEventDrivenAttach();
+    testRegistrationNotifyOnce();
+    testBoot();
+    testConfigureDiff();
+    testNConfigCommit();
+    testModemStatus();
+    testNUEStats();
+    testCoverageDeferral();
+    testUDPSocketTransport();
+    testModemPool();
+    testModuleProfile();
+    testAdaptiveTimeouts();
+    testRetryingAdapter();
+    testLongResponseLine();
+    testCommandPriorities();
+    testLateResponseDropped();
+    testCompressionBoundary();
 
     //
 
@@ -0,0 +1,449 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#include "coap.h"
+#include <string.h>
+
+namespace Narrowband {
+
+// option delta/length nibble and number of extension bytes
+static size_t option_nibble(uint32_t v, uint8_t& nibble) {
+    if ( v < 13) {
+        nibble = (uint8_t)v;
+        return 0;
+    }
+    if ( v < 269) {
+        nibble = 13;
+        return 1;
+    }
+    nibble = 14;
+    return 2;
+}
+
+static uint8_t *put_option_ext(uint8_t *p, uint32_t v, size_t n_ext) {
+    if ( n_ext == 1) {
+        *p++ = (uint8_t)(v-13);
+    } else if ( n_ext == 2) {
+        *p++ = (uint8_t)((v-269) >> 8);
+        *p++ = (uint8_t)(v-269);
+    }
+    return p;
+}
+
+size_t coap_encode(uint8_t *p_buf, size_t sz_buf, uint8_t type, uint8_t code, uint16_t mid,
+                   const uint8_t *p_token, size_t tkl, const CoapOption *p_options, size_t n_options,
+                   const uint8_t *p_payload, size_t payload_length) {
+    if ( tkl > coap_max_token || sz_buf < 4+tkl) {
+        return 0;
+    }
+    uint8_t *p = p_buf;
+    uint8_t *p_end = p_buf+sz_buf;
+
+    *p++ = (uint8_t)(0x40 | ((type & 0x03) << 4) | tkl);
+    *p++ = code;
+    *p++ = (uint8_t)(mid >> 8);
+    *p++ = (uint8_t)mid;
+    if ( tkl > 0) {
+        memcpy(p, p_token, tkl);
+        p += tkl;
+    }
+
+    uint16_t prev = 0;
+    for ( size_t i = 0; i < n_options; i++) {
+        const CoapOption& o = p_options[i];
+        if ( o.number < prev) {
+            return 0;
+        }
+        uint8_t d, l;
+        size_t n_d = option_nibble(o.number-prev, d);
+        size_t n_l = option_nibble(o.length, l);
+        if ( (size_t)(p_end-p) < 1+n_d+n_l+o.length) {
+            return 0;
+        }
+        *p++ = (uint8_t)((d << 4) | l);
+        p = put_option_ext(p, o.number-prev, n_d);
+        p = put_option_ext(p, o.length, n_l);
+        if ( o.length > 0) {
+            memcpy(p, o.p_value, o.length);
+            p += o.length;
+        }
+        prev = o.number;
+    }
+
+    if ( payload_length > 0) {
+        if ( (size_t)(p_end-p) < 1+payload_length) {
+            return 0;
+        }
+        *p++ = 0xFF;
+        memcpy(p, p_payload, payload_length);
+        p += payload_length;
+    }
+    return p-p_buf;
+}
+
+// reads the extended part of an option delta or length
+static const uint8_t *get_option_ext(const uint8_t *p, const uint8_t *p_end, uint8_t nibble, uint32_t& v) {
+    if ( nibble < 13) {
+        v = nibble;
+    } else if ( nibble == 13) {
+        if ( p_end-p < 1) {
+            return NULL;
+        }
+        v = 13+p[0];
+        p++;
+    } else if ( nibble == 14) {
+        if ( p_end-p < 2) {
+            return NULL;
+        }
+        v = 269+((uint32_t)p[0] << 8)+p[1];
+        p += 2;
+    } else {
+        return NULL;
+    }
+    return p;
+}
+
+// parses the option at p, number holds the previous option's number.
+// Returns pointer to next option, NULL on error.
+static const uint8_t *next_option(const uint8_t *p, const uint8_t *p_end, uint32_t& number, CoapOption& o) {
+    uint8_t b = *p++;
+    uint32_t delta, length;
+    p = get_option_ext(p, p_end, b >> 4, delta);
+    if ( p == NULL) {
+        return NULL;
+    }
+    p = get_option_ext(p, p_end, b & 0x0F, length);
+    if ( p == NULL || (uint32_t)(p_end-p) < length) {
+        return NULL;
+    }
+    number += delta;
+    if ( number > 0xFFFF) {
+        return NULL;
+    }
+    o.number = (uint16_t)number;
+    o.length = (uint16_t)length;
+    o.p_value = p;
+    return p+length;
+}
+
+bool coap_decode(const uint8_t *p_data, size_t length, CoapMessage& m) {
+    if ( length < 4 || (p_data[0] >> 6) != 1) {
+        return false;
+    }
+    m.type = (p_data[0] >> 4) & 0x03;
+    m.tkl = p_data[0] & 0x0F;
+    m.code = p_data[1];
+    m.mid = (uint16_t)((p_data[2] << 8) | p_data[3]);
+    if ( m.tkl > coap_max_token || length < 4u+m.tkl) {
+        return false;
+    }
+    memcpy(m.token, p_data+4, m.tkl);
+
+    const uint8_t *p = p_data+4+m.tkl;
+    const uint8_t *p_end = p_data+length;
+    m.p_options = p;
+    m.p_payload = NULL;
+    m.payload_length = 0;
+
+    uint32_t number = 0;
+    while ( p < p_end) {
+        if ( *p == 0xFF) {
+            m.options_length = p-m.p_options;
+            // marker followed by nothing is a format error
+            if ( p+1 == p_end) {
+                return false;
+            }
+            m.p_payload = p+1;
+            m.payload_length = p_end-p-1;
+            return true;
+        }
+        CoapOption o;
+        p = next_option(p, p_end, number, o);
+        if ( p == NULL) {
+            return false;
+        }
+    }
+    m.options_length = p-m.p_options;
+    return true;
+}
+
+bool coap_find_option(const CoapMessage& m, uint16_t number, CoapOption& option) {
+    const uint8_t *p = m.p_options;
+    const uint8_t *p_end = m.p_options+m.options_length;
+    uint32_t n = 0;
+    while ( p != NULL && p < p_end) {
+        p = next_option(p, p_end, n, option);
+        if ( p != NULL && option.number == number) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t coap_uint_value(const CoapOption& option) {
+    uint32_t v = 0;
+    for ( size_t i = 0; i < option.length && i < 4; i++) {
+        v = (v << 8) | option.p_value[i];
+    }
+    return v;
+}
+
+size_t coap_uint_encode(uint32_t v, uint8_t *p_out) {
+    // shortest big endian form, 0 has no bytes
+    size_t n = 0;
+    for ( uint32_t t = v; t != 0; t >>= 8) {
+        n++;
+    }
+    for ( size_t i = 0; i < n; i++) {
+        p_out[i] = (uint8_t)(v >> (8*(n-1-i)));
+    }
+    return n;
+}
+
+
+
+// deadlines are compared with wrap around of the msec clock
+static bool reached(unsigned long now, unsigned long deadline) {
+    return (long)(now-deadline) >= 0;
+}
+
+CoapClient::CoapClient(DatagramTransport& transport, uint8_t *p_tx, size_t sz_tx, uint8_t *p_rx, size_t sz_rx, uint32_t seed) :
+    _transport(transport), _p_tx(p_tx), _sz_tx(sz_tx), _p_rx(p_rx), _sz_rx(sz_rx),
+    _random((seed != 0)?seed:0x2545F491), _szx(6), _retransmissions(0) {
+    _mid = (uint16_t)random();
+}
+
+uint32_t CoapClient::random() {
+    // xorshift32
+    _random ^= _random << 13;
+    _random ^= _random >> 17;
+    _random ^= _random << 5;
+    return _random;
+}
+
+bool CoapClient::setBlockSize(size_t block_size) {
+    for ( uint8_t szx = 0; szx <= 6; szx++) {
+        if ( ((size_t)16 << szx) == block_size) {
+            _szx = szx;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CoapClient::request(uint8_t code, const char *p_path, const uint8_t *p_payload, size_t length,
+                         CoapResponse& response, bool b_confirmable, int content_format) {
+    // Uri-Path, Content-Format, Block1
+    CoapOption options[max_path_segments+2];
+    size_t n = 0;
+
+    const char *p = p_path;
+    while ( *p != 0) {
+        while ( *p == '/') {
+            p++;
+        }
+        const char *p_seg = p;
+        while ( *p != 0 && *p != '/') {
+            p++;
+        }
+        if ( p > p_seg) {
+            if ( n == max_path_segments) {
+                return false;
+            }
+            options[n].number = CoapOptionUriPath;
+            options[n].length = (uint16_t)(p-p_seg);
+            options[n].p_value = (const uint8_t*)p_seg;
+            n++;
+        }
+    }
+
+    uint8_t cf_value[2];
+    if ( content_format >= 0) {
+        options[n].number = CoapOptionContentFormat;
+        options[n].length = (uint16_t)coap_uint_encode((uint32_t)content_format, cf_value);
+        options[n].p_value = cf_value;
+        n++;
+    }
+
+    uint8_t token[4];
+    uint32_t t = random();
+    memcpy(token, &t, sizeof(token));
+
+    size_t limit = _transport.maxDatagram();
+    if ( limit > _sz_tx) {
+        limit = _sz_tx;
+    }
+
+    // header, token and options, plus the payload marker
+    size_t overhead = coap_encode(_p_tx, _sz_tx, CoapConfirmable, code, 0, token, sizeof(token), options, n, NULL, 0)+1;
+    bool b_blockwise = length > blockSize() || overhead == 1 || overhead+length > limit;
+
+    uint8_t block_value[3];
+    uint8_t szx = _szx;
+    if ( b_blockwise) {
+        // largest block that fits with a Block1 option of any NUM
+        block_value[0] = block_value[1] = block_value[2] = 0xFF;
+        options[n].number = CoapOptionBlock1;
+        options[n].length = sizeof(block_value);
+        options[n].p_value = block_value;
+        overhead = coap_encode(_p_tx, _sz_tx, CoapConfirmable, code, 0, token, sizeof(token), options, n+1, NULL, 0)+1;
+        if ( overhead == 1 || overhead+16 > limit) {
+            return false;
+        }
+        while ( overhead+((size_t)16 << szx) > limit) {
+            szx--;
+        }
+    }
+
+    size_t offset = 0;
+    while ( true) {
+        size_t block_size = (size_t)16 << szx;
+        size_t chunk = (length-offset < block_size)?length-offset:block_size;
+        bool b_more = offset+chunk < length;
+        size_t n_options = n;
+
+        if ( b_blockwise) {
+            // NUM | M | SZX
+            uint32_t v = ((uint32_t)(offset/block_size) << 4) | (b_more?0x08:0) | szx;
+            options[n].number = CoapOptionBlock1;
+            options[n].length = (uint16_t)coap_uint_encode(v, block_value);
+            options[n].p_value = block_value;
+            n_options++;
+        }
+
+        uint16_t mid = _mid++;
+        size_t sz = coap_encode(_p_tx, _sz_tx, b_confirmable?CoapConfirmable:CoapNonConfirmable, code, mid,
+                                token, sizeof(token), options, n_options, p_payload+offset, chunk);
+        if ( sz == 0 || sz > limit) {
+            return false;
+        }
+
+        CoapMessage m;
+        if ( !exchange(sz, b_confirmable, mid, token, m)) {
+            return false;
+        }
+
+        if ( b_blockwise && b_more && m.code == CoapContinue) {
+            // server may ask for smaller blocks
+            CoapOption o;
+            if ( coap_find_option(m, CoapOptionBlock1, o)) {
+                uint8_t server_szx = coap_uint_value(o) & 0x07;
+                if ( server_szx < _szx) {
+                    _szx = server_szx;
+                }
+                if ( server_szx < szx) {
+                    szx = server_szx;
+                }
+            }
+            offset += chunk;
+            continue;
+        }
+
+        response.code = m.code;
+        response.p_payload = m.p_payload;
+        response.payload_length = m.payload_length;
+        return true;
+    }
+}
+
+static bool token_matches(const CoapMessage& m, const uint8_t *p_token) {
+    return m.tkl == 4 && memcmp(m.token, p_token, 4) == 0;
+}
+
+bool CoapClient::exchange(size_t length, bool b_confirmable, uint16_t mid, const uint8_t *p_token, CoapMessage& m) {
+    // initial timeout is random between ack_timeout and ack_timeout*ack_random_factor
+    unsigned long timeout = ack_timeout+random() % (ack_timeout*(ack_random_factor_percent-100)/100+1);
+    bool b_separate = false;
+
+    for ( unsigned int attempt = 0; attempt <= max_retransmit && !b_separate; attempt++) {
+        if ( attempt > 0) {
+            _retransmissions++;
+        }
+        if ( !_transport.send(_p_tx, length)) {
+            return false;
+        }
+
+        unsigned long deadline = _transport.now()+(b_confirmable?timeout:response_timeout);
+        while ( receive_until(deadline, m)) {
+            if ( m.type == CoapAcknowledgement && m.mid == mid) {
+                if ( m.code == CoapEmpty) {
+                    // response follows in a message of its own
+                    b_separate = true;
+                    break;
+                }
+                if ( token_matches(m, p_token)) {
+                    return true;
+                }
+            } else if ( m.type == CoapReset && m.mid == mid) {
+                return false;
+            } else if ( m.type != CoapAcknowledgement && m.type != CoapReset && m.code >= 0x40 && token_matches(m, p_token)) {
+                if ( m.type == CoapConfirmable) {
+                    send_empty(CoapAcknowledgement, m.mid);
+                }
+                return true;
+            } else if ( m.type == CoapConfirmable) {
+                // nothing we asked for
+                send_empty(CoapReset, m.mid);
+            }
+        }
+        if ( !b_confirmable) {
+            return false;
+        }
+        timeout *= 2;
+    }
+    if ( !b_separate) {
+        return false;
+    }
+
+    unsigned long deadline = _transport.now()+response_timeout;
+    while ( receive_until(deadline, m)) {
+        if ( (m.type == CoapConfirmable || m.type == CoapNonConfirmable) && m.code >= 0x40 && token_matches(m, p_token)) {
+            if ( m.type == CoapConfirmable) {
+                send_empty(CoapAcknowledgement, m.mid);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CoapClient::receive_until(unsigned long deadline, CoapMessage& m) {
+    while ( true) {
+        unsigned long now = _transport.now();
+        if ( reached(now, deadline)) {
+            return false;
+        }
+        size_t length = 0;
+        if ( !_transport.receive(_p_rx, _sz_rx, length, deadline-now)) {
+            return false;
+        }
+        if ( coap_decode(_p_rx, length, m)) {
+            return true;
+        }
+    }
+}
+
+void CoapClient::send_empty(uint8_t type, uint16_t mid) {
+    uint8_t buf[4];
+    size_t n = coap_encode(buf, sizeof(buf), type, CoapEmpty, mid, NULL, 0, NULL, 0, NULL, 0);
+    _transport.send(buf, n);
+}
+
+}
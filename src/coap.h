@@ -0,0 +1,176 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "datagramtransport.h"
+
+namespace Narrowband {
+
+// CoAP (RFC 7252) message layer and client with block-wise
+// uploads (RFC 7959, Block1). Messages are encoded into and decoded
+// from caller supplied buffers, options are not copied.
+
+enum CoapType {
+    CoapConfirmable = 0,
+    CoapNonConfirmable = 1,
+    CoapAcknowledgement = 2,
+    CoapReset = 3
+};
+
+// codes as class << 5 | detail
+enum CoapCode {
+    CoapEmpty = 0x00,
+    CoapGet = 0x01,
+    CoapPost = 0x02,
+    CoapPut = 0x03,
+    CoapDelete = 0x04,
+    CoapCreated = 0x41,                     // 2.01
+    CoapDeleted = 0x42,
+    CoapValid = 0x43,
+    CoapChanged = 0x44,
+    CoapContent = 0x45,
+    CoapContinue = 0x5F                     // 2.31
+};
+
+enum CoapOptionNumber {
+    CoapOptionUriPath = 11,
+    CoapOptionContentFormat = 12,
+    CoapOptionUriQuery = 15,
+    CoapOptionBlock2 = 23,
+    CoapOptionBlock1 = 27
+};
+
+static const size_t coap_max_token = 8;
+
+struct CoapOption {
+    uint16_t        number;
+    uint16_t        length;
+    const uint8_t   *p_value;
+};
+
+// decoded message, pointers refer to the decoded buffer
+struct CoapMessage {
+    uint8_t         type;
+    uint8_t         code;
+    uint16_t        mid;
+    uint8_t         tkl;
+    uint8_t         token[coap_max_token];
+    const uint8_t   *p_options;             // encoded options
+    size_t          options_length;
+    const uint8_t   *p_payload;
+    size_t          payload_length;
+};
+
+// encodes a message into p_buf. Options have to be sorted by number.
+// Returns size of message, 0 if it does not fit into sz_buf.
+size_t coap_encode(uint8_t *p_buf, size_t sz_buf, uint8_t type, uint8_t code, uint16_t mid,
+                   const uint8_t *p_token, size_t tkl, const CoapOption *p_options, size_t n_options,
+                   const uint8_t *p_payload, size_t payload_length);
+
+// returns false if p_data is not a well formed message
+bool coap_decode(const uint8_t *p_data, size_t length, CoapMessage& m);
+
+// finds the first option number in m
+bool coap_find_option(const CoapMessage& m, uint16_t number, CoapOption& option);
+
+// unsigned integer option values
+uint32_t coap_uint_value(const CoapOption& option);
+size_t coap_uint_encode(uint32_t v, uint8_t *p_out);
+
+// result of a CoapClient request. Payload points into the client's
+// receive buffer and is valid until the next request.
+struct CoapResponse {
+    uint8_t         code;
+    const uint8_t   *p_payload;
+    size_t          payload_length;
+};
+
+class CoapClient {
+public:
+    // RFC 7252 transmission parameters
+    static const unsigned long ack_timeout = 2000;
+    static const unsigned int ack_random_factor_percent = 150;
+    static const unsigned int max_retransmit = 4;
+
+    // wait for a separate or non-confirmable response
+    static const unsigned long response_timeout = 30000;
+
+    // Uri-Path segments per request
+    static const size_t max_path_segments = 8;
+
+    // messages are built in p_tx (of the transport's maxDatagram()) and
+    // received into p_rx. seed initializes message IDs and tokens, pass
+    // something random.
+    CoapClient(DatagramTransport& transport, uint8_t *p_tx, size_t sz_tx, uint8_t *p_rx, size_t sz_rx, uint32_t seed);
+
+    // sends a request to p_path ("a/b/c") and waits for its response.
+    // Payloads larger than blockSize() are uploaded in blocks (Block1).
+    // content_format < 0 omits the Content-Format option.
+    bool request(uint8_t code, const char *p_path, const uint8_t *p_payload, size_t length,
+                 CoapResponse& response, bool b_confirmable = true, int content_format = -1);
+
+    bool get(const char *p_path, CoapResponse& response) {
+        return request(CoapGet, p_path, NULL, 0, response);
+    }
+    bool post(const char *p_path, const uint8_t *p_payload, size_t length, CoapResponse& response) {
+        return request(CoapPost, p_path, p_payload, length, response);
+    }
+    bool put(const char *p_path, const uint8_t *p_payload, size_t length, CoapResponse& response) {
+        return request(CoapPut, p_path, p_payload, length, response);
+    }
+
+    // largest block size for uploads, 16 to 1024 (power of 2). Default
+    // 1024. Blocks are smaller where a block with header and options
+    // would not fit into the transport's maxDatagram().
+    bool setBlockSize(size_t block_size);
+    size_t blockSize() const { return (size_t)16 << _szx; }
+
+    unsigned long retransmissions() const { return _retransmissions; }
+
+protected:
+    // sends one message and waits for the response matching mid/token
+    bool exchange(size_t length, bool b_confirmable, uint16_t mid, const uint8_t *p_token, CoapMessage& response);
+
+    // waits for a message until deadline (now() based)
+    bool receive_until(unsigned long deadline, CoapMessage& m);
+
+    void send_empty(uint8_t type, uint16_t mid);
+
+    uint32_t random();
+
+    DatagramTransport&  _transport;
+    uint8_t             *_p_tx;
+    size_t              _sz_tx;
+    uint8_t             *_p_rx;
+    size_t              _sz_rx;
+    uint32_t            _random;
+    uint16_t            _mid;
+    uint8_t             _szx;
+    unsigned long       _retransmissions;
+
+private:
+    CoapClient(const CoapClient&);
+    CoapClient& operator=(const CoapClient&);
+};
+
+}
@@ -21,6 +21,7 @@
 #include <cstdlib>
 #include "modemresponse.h"
 #include "commandadapter.h"
+#include "hexcodec.h"
 
 
 namespace Narrowband {
@@ -63,8 +64,63 @@ void debug_0_impl(const char *p, const size_t sz, char prefix) {
 }
 
 
+// keys of responses that are always unsolicited, even when they
+// arrive while the response to a command is being read.
+static const char * const urc_only_keys[] = { "+NSONMI:", NULL };
+
+// status URCs that share their key with the response to a query. The
+// query response starts with the <n> setting followed by the status, the
+// URC with the status followed by quoted strings, if anything.
+static const char * const urc_status_keys[] = { "+CEREG:", "+CSCON:", NULL };
+
+static bool is_urc_only(const string& line) {
+    for ( const char * const *p = urc_only_keys; *p != NULL; p++) {
+        if ( line.compare(0, strlen(*p), *p) == 0) {
+            return true;
+        }
+    }
+    for ( const char * const *p = urc_status_keys; *p != NULL; p++) {
+        if ( line.compare(0, strlen(*p), *p) == 0) {
+            size_t n = line.find(',');
+            return n == string::npos || (n+1 < line.length() && line[n+1] == '"');
+        }
+    }
+    return false;
+}
+
+// length of the verb of a command with its '=' or '?', "AT+NSOST=" of
+// "AT+NSOST=1,...". A query and a write of one command differ in latency.
+static size_t verb_suffix_length(const char *p_cmd) {
+    size_t n = strcspn(p_cmd, "=?");
+    return (p_cmd[n] != 0)?n+1:n;
+}
+
+string command_verb(const char *p_cmd) {
+    return string(p_cmd, verb_suffix_length(p_cmd));
+}
+
+// verb_suffix_length() truncated to fit CommandTiming::verb
+static size_t verb_length(const char *p_cmd) {
+    size_t n = verb_suffix_length(p_cmd);
+    return (n < sizeof(((CommandTiming*)0)->verb))?n:sizeof(((CommandTiming*)0)->verb)-1;
+}
+
+static bool is_verb(const CommandTiming& t, const char *p_cmd, size_t n) {
+    return t.samples+t.timeouts > 0 && strncmp(t.verb, p_cmd, n) == 0 && t.verb[n] == 0;
+}
+
 template <typename T> 
-CommandAdapter<T>::CommandAdapter(T& modem) : CommandAdapterBase(), _state(idle), _modem(modem), _cur_response(NULL) {
+CommandAdapter<T>::CommandAdapter(T& modem) : CommandAdapterBase(), _state(idle), _modem(modem),
+    _rx_line_len(0), _rx_overruns(0), _line_len(0), _cur_response(NULL),
+    _b_adaptive(false), _timeout_floor(default_timeout_floor), _timeout_ceiling(default_timeout_ceiling), _timing_seq(0),
+    _b_busy(false), _cmd_seq(0), _abandoned_seq(0), _b_drop_partial(false), _drain_until(0), _late_response_window(default_late_response_window) {
+    memset(&_correlation_stats, 0, sizeof(_correlation_stats));
+    memset(_timings, 0, sizeof(_timings));
+    for ( size_t i = 0; i < max_prioritized_threads; i++) {
+        // entries in use have a priority other than normal
+        _thread_priorities[i].priority = PriorityNormal;
+    }
+    memset(_priority_stats, 0, sizeof(_priority_stats));
     reset_buf();
     _modem.attach(callback(this, &CommandAdapter<T>::recv_cb), RawSerial::RxIrq);
     _thread.start(callback(this, &CommandAdapter<T>::thread_cb));
@@ -81,7 +137,9 @@ CommandAdapter<T>::~CommandAdapter() {
 
 template <typename T>
 void CommandAdapter<T>::reset_buf() {
-    _buf.reset();
+    _ring.clear();
+    _rx_line_len = 0;
+    _line_len = 0;
 }
 
 template <typename T>
@@ -93,6 +151,12 @@ ModemResponseAlloc* CommandAdapter<T>::get_current_response() {
     return _cur_response;
 }
 
+// line ends at LF, or when it does not fit the line buffer. recv_cb and
+// thread_cb apply this to the same chars, so they agree on line ends.
+static inline bool is_line_end(char c, size_t len, size_t max_len) {
+    return (len >= 2 && c == '\n') || len >= max_len;
+}
+
 template <typename T>
 void CommandAdapter<T>::recv_cb() {   
     if (get_state() == receiving_response) {
@@ -104,29 +168,18 @@ void CommandAdapter<T>::recv_cb() {
         }
     }
 
-    int c = _modem.getc();
-    if ( !_buf.full()) {
-        _buf.push(c);
+    char c = (char)_modem.getc();
+    if ( !_ring.push((uint8_t)c)) {
+        // lost, thread_cb never sees it, so it does not count toward the
+        // line. The ring was signalled when it filled up.
+        _rx_overruns++;
+        return;
     }
 
     // check EOL
-    if ( (_buf.size() >= 2 && c == '\n') || _buf.full()) {
-        
-        // shovel into a string
-        string *line = new string();
-        while(!_buf.empty()) {
-            char d;
-            if (_buf.pop(d)) {
-                line->push_back(d);
-            }
-        }
-
-        // strip ws
-        line->erase(line->find_last_not_of("\t\n\v\f\r ") + 1);
-        // put into queue for thread to pick it up.
-        _queue.put(line);
-
-        reset_buf();
+    if ( is_line_end(c, ++_rx_line_len, max_line_length) || _ring.full()) {
+        _rx_line_len = 0;
+        _thread.signal_set(0x01);
 
         // if this line was unsolicited, go to idle again
         if (get_state() == receiving_unsolicited_response) {
@@ -137,124 +190,573 @@ void CommandAdapter<T>::recv_cb() {
 
 template <typename T>
 void CommandAdapter<T>::thread_cb() {
-     while (true) {
-        osEvent evt = _queue.get();
-        if (evt.status == osEventMessage) {
-            string *line = (string*)evt.value.p;
-
-            ModemResponse *r = get_current_response()->obj;
-
-            if ( line->length() > 0) {
-                // store infos in _cur_response
-
-                debug_0(line->c_str(), line->length(), '<');
-
-                bool b = false;
-                if (line->find("OK") == 0) {
-                    b = true;
-                    r->b_ok = true;
-                } 
-                if (line->find("ERROR") == 0) {
-                    b = true;
-                    r->b_error = true;
-                }
-                std::size_t cme_error_pos = line->find("+CME ERROR: ");
-                if (cme_error_pos != std::string::npos) {
-                    b = true;
-                    r->b_error = true;
-
-                    string code = line->substr(cme_error_pos+12);
-                    r->errcode = atoi(code.c_str());
+    while (true) {
+        Thread::signal_wait(0x01);
+
+        uint8_t c;
+        while ( _ring.pop(c)) {
+            _line[_line_len++] = (char)c;
+            if ( is_line_end((char)c, _line_len, max_line_length)) {
+                // strip ws
+                size_t n = _line_len;
+                while ( n > 0 && strchr("\t\n\v\f\r ", _line[n-1]) != NULL) {
+                    n--;
                 }
-                if ( !r->b_error && (*line)[0] == '+') {
-                    b = true;
-                    // split urc
-                    int pos = line->find(':');
-                    if ( pos >= 0) {
-                        string key = line->substr(0,pos);
-                        string value = line->substr(pos+1, line->length());
-                        r->cmdresponses.insert(pair<string,string>(key,value));
-                    } else {
-                        // unable to parse? add to others
-                        r->responses.push_back(*line);
-                    }
-                } 
-
-                if ( !b) {
-                    r->responses.push_back(*line);
-                }
-        
-                
+                _line_len = 0;
+                process_line(string(_line, n));
             }
+        }
+    }
+}
+
+template <typename T>
+void CommandAdapter<T>::process_line(const string& line) {
+    if ( _b_drop_partial) {
+        // rest of a response that was given up on
+        _b_drop_partial = false;
+        if ( _cur_response != NULL) {
+            ModemResponse_delete(_cur_response);
+            _mail.free(_cur_response);
+            _cur_response = NULL;
+        }
+    }
 
-            if ( get_state() == receiving_unsolicited_response) {
-                // TODO deliver to urc callbacks.
+    ModemResponse *r = get_current_response()->obj;
 
-                // remove. Next message goes into new response struct.
-                ModemResponse_delete(_cur_response);
-                _cur_response = NULL;
-            } else {
-                // deliver to mailbox if either flag is set
-                if ( (r->isOk() || r->hasError()) ) {
-                    // either ..
-                    // - we finished reading one block of response that came from a command
-                    // - or this is a single line of unsolicited stuff
+    if ( line.length() > 0 && is_urc_only(line)) {
+        debug_0(line.c_str(), line.length(), '<');
 
-                    // off to mailbox
-                    _mail.put(get_current_response());
+        // deliver right away, do not mix into a pending response.
+        ModemResponse u;
+        u.b_unsolicited = true;
+        int pos = line.find(':');
+        u.cmdresponses.insert(pair<string,string>(line.substr(0,pos), line.substr(pos+1, line.length())));
+        dispatch_urc(u);
 
-                    // forget _cur_response, so next message allocates a new one
-                    _cur_response = NULL;
+        return;
+    }
 
-                    // we're done with this message.
-                    set_state(idle);
-                }
+    if ( line.length() > 0) {
+        // store infos in _cur_response
+
+        debug_0(line.c_str(), line.length(), '<');
+
+        bool b = false;
+        if (line.find("OK") == 0) {
+            b = true;
+            r->b_ok = true;
+        } 
+        if (line.find("ERROR") == 0) {
+            b = true;
+            r->b_error = true;
+        }
+        std::size_t cme_error_pos = line.find("+CME ERROR: ");
+        if (cme_error_pos != std::string::npos) {
+            b = true;
+            r->b_error = true;
+
+            string code = line.substr(cme_error_pos+12);
+            r->errcode = atoi(code.c_str());
+        }
+        if ( !r->b_error && line[0] == '+') {
+            b = true;
+            // split urc
+            int pos = line.find(':');
+            if ( pos >= 0) {
+                string key = line.substr(0,pos);
+                string value = line.substr(pos+1, line.length());
+                r->cmdresponses.insert(pair<string,string>(key,value));
+            } else {
+                // unable to parse? add to others
+                r->responses.push_back(line);
             }
+        } 
+
+        if ( !b) {
+            r->responses.push_back(line);
+        }
+
+
+    }
+
+    if ( get_state() == receiving_unsolicited_response || get_state() == idle) {
+        // no command is waiting for this, deliver to urc callbacks.
+        if ( line.length() > 0) {
+            r->b_unsolicited = true;
+            debug_1(r);
+            dispatch_urc(*r);
+        }
+
+        // remove. Next message goes into new response struct.
+        ModemResponse_delete(_cur_response);
+        _mail.free(_cur_response);
+        _cur_response = NULL;
+    } else {
+        // deliver to mailbox if either flag is set
+        if ( !r->isOk() && !r->hasError()) {
+            return;
+        }
+        // responses come in the order of the commands. No command is
+        // written while an abandoned one awaits its response, so this
+        // answers the abandoned command if there is one.
+        unsigned long seq = _abandoned_seq;
+        if ( seq == 0) {
+            seq = _cmd_seq;
+        }
+        _cur_response->seq = seq;
+
+        if ( seq == _abandoned_seq) {
+            // late response of an abandoned command, nobody waits for it
+            ModemResponse_delete(_cur_response);
+            _mail.free(_cur_response);
+            _cur_response = NULL;
+
+            _arb_mtx.lock();
+            _correlation_stats.late_dropped++;
+            _arb_mtx.unlock();
+            _abandoned_seq = 0;
+            set_state(idle);
+        } else {
+            // we finished reading one block of response that came from
+            // a command. Go idle before handing it off, the receiver may
+            // send the next command right away.
+            set_state(idle);
+
+            // off to mailbox
+            _mail.put(get_current_response());
+
+            // forget _cur_response, so next message allocates a new one
+            _cur_response = NULL;
+        }
+    }
+}
+
+template <typename T>
+void CommandAdapter<T>::dispatch_urc(ModemResponse& r) {
+    for ( size_t i = 0; i < max_urc_handlers; i++) {
+        if ( _urc_handlers[i]) {
+            _urc_handlers[i](r);
+        }
+    }
+}
 
-            delete line;
+template <typename T>
+bool CommandAdapter<T>::addURCHandler(Callback<void(ModemResponse&)> cb) {
+    for ( size_t i = 0; i < max_urc_handlers; i++) {
+        if ( !_urc_handlers[i]) {
+            _urc_handlers[i] = cb;
+            return true;
         }
-     }
+    }
+    return false;
 }
 
+template <typename T>
+bool CommandAdapter<T>::removeURCHandler(Callback<void(ModemResponse&)> cb) {
+    for ( size_t i = 0; i < max_urc_handlers; i++) {
+        if ( _urc_handlers[i] && _urc_handlers[i] == cb) {
+            _urc_handlers[i] = Callback<void(ModemResponse&)>();
+            return true;
+        }
+    }
+    return false;
+}
 
 template <typename T>
 bool CommandAdapter<T>::ensure_state(ModemCommandState s, unsigned long timeout) {
-    while( _state != s);
+    uint64_t start = Kernel::get_ms_count();
+    while( _state != s) {
+        uint64_t now = Kernel::get_ms_count();
+        if ( _state == draining_response && now >= _drain_until) {
+            // the late response did not come, forget what arrived of it
+            _arb_mtx.lock();
+            _correlation_stats.drains_expired++;
+            _arb_mtx.unlock();
+            _abandoned_seq = 0;
+            _b_drop_partial = true;
+            set_state(idle);
+            continue;
+        }
+        if ( timeout > 0 && now-start >= timeout) {
+            return false;
+        }
+        if ( _state == draining_response) {
+            Thread::wait(1);
+        } else {
+            Thread::yield();
+        }
+    }
     return true;
 }
 
 template <typename T>
-bool CommandAdapter<T>::send(const char *p_cmd, ModemResponse& r, unsigned long timeout) {
-    if (p_cmd == NULL || strlen(p_cmd) < 2 || !(p_cmd[0]=='A' && p_cmd[1]=='T') ) {
+void CommandAdapter<T>::write_command(const char *p_cmd, const uint8_t *p_payload, size_t length) {
+    debug_0(p_cmd, strlen(p_cmd), '>' );
+
+    set_state(sending_command);
+    _modem.puts(p_cmd);
+
+    // encode payload chunk by chunk straight into the TX path
+    char hex[2*payload_chunk_size+1];
+    while ( length > 0) {
+        size_t n = (length < payload_chunk_size)?length:payload_chunk_size;
+        hex[hex_encode(p_payload, n, hex)] = 0;
+        debug_0(hex, 2*n, '>');
+        _modem.puts(hex);
+
+        p_payload += n;
+        length -= n;
+    }
+
+    _modem.putc('\r');
+    _modem.putc('\n');
+    set_state(receiving_response);
+}
+
+template <typename T>
+void CommandAdapter<T>::setAdaptiveTimeouts(bool b_enable, unsigned long floor, unsigned long ceiling) {
+    _b_adaptive = b_enable;
+    _timeout_floor = floor;
+    _timeout_ceiling = (ceiling > floor)?ceiling:floor;
+}
+
+template <typename T>
+bool CommandAdapter<T>::commandTiming(const char *p_cmd, CommandTiming& t) const {
+    size_t n = verb_length(p_cmd);
+    for ( size_t i = 0; i < max_timed_verbs; i++) {
+        if ( is_verb(_timings[i], p_cmd, n)) {
+            t = _timings[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+CommandTiming* CommandAdapter<T>::find_timing(const char *p_cmd, bool b_add) {
+    size_t n = verb_length(p_cmd);
+    CommandTiming *p_oldest = &_timings[0];
+    for ( size_t i = 0; i < max_timed_verbs; i++) {
+        if ( is_verb(_timings[i], p_cmd, n)) {
+            return &_timings[i];
+        }
+        if ( _timings[i].last_used < p_oldest->last_used) {
+            p_oldest = &_timings[i];
+        }
+    }
+    if ( !b_add) {
+        return NULL;
+    }
+    memset(p_oldest, 0, sizeof(CommandTiming));
+    memcpy(p_oldest->verb, p_cmd, n);
+    return p_oldest;
+}
+
+template <typename T>
+unsigned long CommandAdapter<T>::adapt_timeout(const char *p_cmd, unsigned long timeout) {
+    if ( !_b_adaptive) {
+        return timeout;
+    }
+    CommandTiming *p_t = find_timing(p_cmd, false);
+    if ( p_t == NULL || p_t->rto == 0) {
+        return timeout;
+    }
+    p_t->last_used = ++_timing_seq;
+    return p_t->rto;
+}
+
+template <typename T>
+void CommandAdapter<T>::record_timing(const char *p_cmd, bool b_responded, unsigned long ms) {
+    if ( !_b_adaptive) {
+        return;
+    }
+    CommandTiming *p_t = find_timing(p_cmd, true);
+    p_t->last_used = ++_timing_seq;
+    if ( !b_responded) {
+        // back off, the next response tells whether it was the modem
+        p_t->timeouts++;
+        if ( p_t->rto > 0) {
+            p_t->rto = (2*p_t->rto < _timeout_ceiling)?2*p_t->rto:_timeout_ceiling;
+        }
+        return;
+    }
+
+    if ( p_t->samples == 0) {
+        p_t->srtt = ms;
+        p_t->rttvar = ms/2;
+    } else {
+        unsigned long delta = (ms > p_t->srtt)?ms-p_t->srtt:p_t->srtt-ms;
+        p_t->rttvar = (3*p_t->rttvar+delta)/4;
+        p_t->srtt = (7*p_t->srtt+ms)/8;
+    }
+    p_t->samples++;
+
+    unsigned long rto = p_t->srtt+4*p_t->rttvar;
+    p_t->rto = (rto < _timeout_floor)?_timeout_floor:((rto > _timeout_ceiling)?_timeout_ceiling:rto);
+}
+
+template <typename T>
+CommandPriority CommandAdapter<T>::setCommandPriority(CommandPriority p) {
+    osThreadId id = Thread::gettid();
+    CommandPriority prev = PriorityNormal;
+    _arb_mtx.lock();
+    ThreadPriority *p_free = NULL;
+    for ( size_t i = 0; i < max_prioritized_threads; i++) {
+        ThreadPriority& tp = _thread_priorities[i];
+        if ( tp.priority != PriorityNormal && tp.id == id) {
+            prev = tp.priority;
+            tp.priority = p;
+            p_free = NULL;
+            break;
+        }
+        if ( tp.priority == PriorityNormal && p_free == NULL) {
+            p_free = &tp;
+        }
+    }
+    if ( prev == PriorityNormal && p != PriorityNormal && p_free != NULL) {
+        p_free->id = id;
+        p_free->priority = p;
+    }
+    _arb_mtx.unlock();
+    return prev;
+}
+
+template <typename T>
+CommandPriority CommandAdapter<T>::current_priority() {
+    osThreadId id = Thread::gettid();
+    CommandPriority res = PriorityNormal;
+    _arb_mtx.lock();
+    for ( size_t i = 0; i < max_prioritized_threads; i++) {
+        if ( _thread_priorities[i].priority != PriorityNormal && _thread_priorities[i].id == id) {
+            res = _thread_priorities[i].priority;
+            break;
+        }
+    }
+    _arb_mtx.unlock();
+    return res;
+}
+
+template <typename T>
+bool CommandAdapter<T>::acquire(CommandPriority p, unsigned long timeout) {
+    uint64_t start = Kernel::get_ms_count();
+    PriorityStats& ps = _priority_stats[p];
+
+    _arb_mtx.lock();
+    if ( !_b_busy) {
+        _b_busy = true;
+        ps.commands++;
+        _arb_mtx.unlock();
+        return true;
+    }
+
+    // queue behind waiters of same or higher priority
+    Semaphore sem(0);
+    Waiter w = { p, &sem, false };
+    typename list<Waiter*>::iterator it = _waiters.begin();
+    while ( it != _waiters.end() && (*it)->priority >= p) {
+        ++it;
+    }
+    _waiters.insert(it, &w);
+    _arb_mtx.unlock();
+
+    sem.wait(timeout);
+
+    _arb_mtx.lock();
+    if ( !w.b_granted) {
+        _waiters.remove(&w);
+        ps.timeouts++;
+        _arb_mtx.unlock();
         return false;
     }
+    unsigned long waited = (unsigned long)(Kernel::get_ms_count()-start);
+    ps.commands++;
+    ps.waited++;
+    ps.total_wait += waited;
+    if ( waited > ps.max_wait) {
+        ps.max_wait = waited;
+    }
+    _arb_mtx.unlock();
+    return true;
+}
+
+template <typename T>
+void CommandAdapter<T>::release() {
+    _arb_mtx.lock();
+    if ( _waiters.empty()) {
+        _b_busy = false;
+    } else {
+        // stays busy, ownership goes to the waiter
+        Waiter *p_w = _waiters.front();
+        _waiters.pop_front();
+        p_w->b_granted = true;
+        p_w->p_sem->release();
+    }
+    _arb_mtx.unlock();
+}
+
+template <typename T>
+bool CommandAdapter<T>::priorityStats(CommandPriority p, PriorityStats& s) const {
+    if ( p < 0 || p >= command_priority_count) {
+        return false;
+    }
+    _arb_mtx.lock();
+    s = _priority_stats[p];
+    _arb_mtx.unlock();
+    return true;
+}
+
+template <typename T>
+void CommandAdapter<T>::resetPriorityStats() {
+    _arb_mtx.lock();
+    memset(_priority_stats, 0, sizeof(_priority_stats));
+    _arb_mtx.unlock();
+}
+
+template <typename T>
+ModemResponseAlloc* CommandAdapter<T>::transact(const char *p_cmd, const uint8_t *p_payload, size_t length, unsigned long timeout) {
+    uint64_t start = Kernel::get_ms_count();
+    if ( !acquire(current_priority(), timeout)) {
+        return NULL;
+    }
+    // the exchange gets what is left after waiting for our turn
+    unsigned long waited = (unsigned long)(Kernel::get_ms_count()-start);
+    if ( waited >= timeout) {
+        release();
+        return NULL;
+    }
+    unsigned long left = timeout-waited;
+    unsigned long t = adapt_timeout(p_cmd, left);
+    ModemResponseAlloc* p_m = exchange(p_cmd, p_payload, length, (t < left)?t:left);
+    release();
+    return p_m;
+}
 
+template <typename T>
+ModemResponseAlloc* CommandAdapter<T>::exchange(const char *p_cmd, const uint8_t *p_payload, size_t length, unsigned long timeout) {
     // wait for adapter to become idle..
-    if (ensure_state(idle, timeout)) {
-        size_t l = strlen(p_cmd);
-        debug_0(p_cmd, l, '>' );
-
-        set_state(sending_command);
-        _modem.puts(p_cmd);
-        _modem.putc('\r');
-        _modem.putc('\n');
-        set_state(receiving_response);
-
-        // wait for response.
-        osEvent evt = _mail.get(timeout);
-        if (evt.status == osEventMail) {
-            ModemResponseAlloc* p_m = (ModemResponseAlloc*)evt.value.p;
-            r = *(p_m->obj);
-
-            debug_1(&r);
-
-            // free the allocator wrapper
-            _mail.free(p_m);
-            return true;
+    if (!ensure_state(idle, timeout)) {
+        return NULL;
+    }
+    drop_stale_responses();
+
+    unsigned long seq = _cmd_seq+1;
+    _cmd_seq = seq;
+    write_command(p_cmd, p_payload, length);
+    uint64_t sent = Kernel::get_ms_count();
+
+    // wait for response, skip those of earlier commands
+    ModemResponseAlloc *p_m = NULL;
+    bool b_cancelled = false;
+    for (;;) {
+        unsigned long elapsed = (unsigned long)(Kernel::get_ms_count()-sent);
+        osEvent evt = _mail.get((elapsed < timeout)?timeout-elapsed:0);
+        if (evt.status != osEventMail) {
+            break;
+        }
+        ModemResponseAlloc *p = (ModemResponseAlloc*)evt.value.p;
+        if ( p->seq == seq && p->obj != NULL) {
+            p_m = p;
+            break;
+        }
+        b_cancelled = (p->seq == seq);
+        if ( p->obj != NULL) {
+            _arb_mtx.lock();
+            _correlation_stats.late_dropped++;
+            _arb_mtx.unlock();
+        }
+        ModemResponse_delete(p);
+        _mail.free(p);
+        if ( b_cancelled) {
+            break;
         }
+    }
+
+    if ( !b_cancelled) {
+        record_timing(p_cmd, p_m != NULL, (unsigned long)(Kernel::get_ms_count()-sent));
+    }
+    if ( p_m == NULL) {
+        // don't wait for the response forever, the next command would hang
+        abandon(seq, b_cancelled);
+    }
+    return p_m;
+}
+
+template <typename T>
+void CommandAdapter<T>::abandon(unsigned long seq, bool b_cancelled) {
+    _arb_mtx.lock();
+    _correlation_stats.abandoned++;
+    if ( b_cancelled) {
+        _correlation_stats.cancelled++;
+    }
+    _arb_mtx.unlock();
+
+    // if the response is still to come, drop it on arrival. Otherwise
+    // it is in _mail already, or the modem never answers.
+    _drain_until = Kernel::get_ms_count()+_late_response_window;
+    if ( get_state() == receiving_response || get_state() == sending_command) {
+        _abandoned_seq = seq;
+        set_state(draining_response);
+    }
+}
 
+template <typename T>
+void CommandAdapter<T>::drop_stale_responses() {
+    for (;;) {
+        osEvent evt = _mail.get(0);
+        if (evt.status != osEventMail) {
+            return;
+        }
+        ModemResponseAlloc *p = (ModemResponseAlloc*)evt.value.p;
+        if ( p->obj != NULL) {
+            _arb_mtx.lock();
+            _correlation_stats.late_dropped++;
+            _arb_mtx.unlock();
+        }
+        ModemResponse_delete(p);
+        _mail.free(p);
     }
+}
 
+template <typename T>
+bool CommandAdapter<T>::cancel() {
+    if ( get_state() != sending_command && get_state() != receiving_response) {
+        return false;
+    }
+    // wakes the sender, tagged with the command's sequence number
+    ModemResponseAlloc *p = _mail.calloc();
+    if ( p == NULL) {
+        return false;
+    }
+    p->obj = NULL;
+    p->seq = _cmd_seq;
+    _mail.put(p);
+    return true;
+}
+
+template <typename T>
+void CommandAdapter<T>::correlationStats(CorrelationStats& s) const {
+    _arb_mtx.lock();
+    s = _correlation_stats;
+    _arb_mtx.unlock();
+}
+
+template <typename T>
+bool CommandAdapter<T>::send(const char *p_cmd, ModemResponse& r, unsigned long timeout) {
+    if (p_cmd == NULL || strlen(p_cmd) < 2 || !(p_cmd[0]=='A' && p_cmd[1]=='T') ) {
+        return false;
+    }
+
+    ModemResponseAlloc* p_m = transact(p_cmd, NULL, 0, timeout);
+    if ( p_m != NULL) {
+        r = *(p_m->obj);
+
+        debug_1(&r);
+
+        // free the response and its allocator wrapper
+        ModemResponse_delete(p_m);
+        _mail.free(p_m);
+        return true;
+    }
     return false;
 }
 
@@ -264,34 +766,38 @@ bool CommandAdapter<T>::send(const char *p_cmd, Callback<void(ModemResponse&)> c
         return false;
     }
 
-    // wait for adapter to become idle..
-    if (ensure_state(idle, timeout)) {
-        size_t l = strlen(p_cmd);
-        debug_0(p_cmd, l, '>' );
-
-        set_state(sending_command);
-        _modem.puts(p_cmd);
-        _modem.putc('\r');
-        _modem.putc('\n');
-        set_state(receiving_response);
-
-        // wait for response.
-        osEvent evt = _mail.get(timeout);
-        if (evt.status == osEventMail) {
-            ModemResponseAlloc* p_m = (ModemResponseAlloc*)evt.value.p;
-
-            debug_1(p_m->obj);
-            // call back
-            cb(*(p_m->obj));
-
-            _mail.free(p_m);
-            return true;
-        }
-    }
+    ModemResponseAlloc* p_m = transact(p_cmd, NULL, 0, timeout);
+    if ( p_m != NULL) {
+        debug_1(p_m->obj);
+        // call back
+        cb(*(p_m->obj));
 
+        ModemResponse_delete(p_m);
+        _mail.free(p_m);
+        return true;
+    }
     return false;
 }
 
+template <typename T>
+bool CommandAdapter<T>::sendPayload(const char *p_header, const uint8_t *p_payload, size_t length, ModemResponse& r, unsigned long timeout) {
+    if (p_header == NULL || strlen(p_header) < 2 || !(p_header[0]=='A' && p_header[1]=='T') || (p_payload == NULL && length > 0)) {
+        return false;
+    }
+
+    ModemResponseAlloc* p_m = transact(p_header, p_payload, length, timeout);
+    if ( p_m != NULL) {
+        r = *(p_m->obj);
+
+        debug_1(&r);
+
+        // free the response and its allocator wrapper
+        ModemResponse_delete(p_m);
+        _mail.free(p_m);
+        return true;
+    }
+    return false;
+}
 
 template class CommandAdapter<mbed::RawSerial>;
 
@@ -29,6 +29,7 @@
 using namespace std;
 
 #include <modemresponse.h>
+#include "spscring.h"
 
 namespace Narrowband {
 
@@ -39,11 +40,53 @@ void debug_0_impl(const char *p, const size_t sz, char prefix);
 #define debug_0(a,b,c)
 #endif
 
+// verb of a command up to and including its '=' or '?', e.g. "AT+NSOST="
+// or "AT+CGATT?", so the query and write forms of a command are kept apart
+string command_verb(const char *p_cmd);
+
 enum ModemCommandState {
     idle = 0,
     sending_command,
     receiving_response,
-    receiving_unsolicited_response
+    receiving_unsolicited_response,
+    draining_response                       // a command was abandoned, its response is dropped
+};
+
+// commands that got no response in time
+struct CorrelationStats {
+    unsigned long   abandoned;              // commands that timed out or were cancelled
+    unsigned long   cancelled;              // of these, cancelled by cancel()
+    unsigned long   late_dropped;           // responses that came after their command was abandoned
+    unsigned long   drains_expired;         // abandoned commands whose response never came
+};
+
+// observed latency of one command verb (e.g. "AT+NSOST="), msecs.
+// Smoothed as in TCP (RFC 6298).
+struct CommandTiming {
+    char            verb[16];
+    unsigned long   srtt;                   // smoothed latency
+    unsigned long   rttvar;                 // latency variation
+    unsigned long   rto;                    // timeout to use next, within floor and ceiling
+    unsigned long   samples;                // responses measured
+    unsigned long   timeouts;               // commands that timed out
+    unsigned long   last_used;              // for replacement, sequence number
+};
+
+// order in which threads waiting for the adapter get it
+enum CommandPriority {
+    PriorityBackground = 0,                 // status polls, statistics
+    PriorityNormal,
+    PriorityUrgent,                         // e.g. alarm uplinks
+    command_priority_count
+};
+
+// wait times of commands of one priority, msecs
+struct PriorityStats {
+    unsigned long   commands;               // commands that got the adapter
+    unsigned long   waited;                 // of these, commands that had to wait
+    unsigned long   total_wait;
+    unsigned long   max_wait;
+    unsigned long   timeouts;               // commands that gave up waiting
 };
 
 class CommandAdapterBase {
@@ -54,6 +97,24 @@ public:
 
     virtual bool send(const char *p_cmd, Callback<void(ModemResponse&)> cb, unsigned long timeout) = 0;
 
+    // send command made of p_header followed by length bytes from p_payload,
+    // hex encoded in small chunks while writing to the modem. The full
+    // command is never held in memory.
+    virtual bool sendPayload(const char *p_header, const uint8_t *p_payload, size_t length, ModemResponse& r, unsigned long timeout) = 0;
+
+    // registers a callback for unsolicited responses (e.g. +NSONMI).
+    // Callbacks run on the adapter's thread and must not send commands.
+    virtual bool addURCHandler(Callback<void(ModemResponse&)> cb) = 0;
+    virtual bool removeURCHandler(Callback<void(ModemResponse&)> cb) = 0;
+
+    // priority of the commands the calling thread sends from now on,
+    // returns the previous one. Ignored by adapters without arbitration.
+    virtual CommandPriority setCommandPriority(CommandPriority /*p*/) { return PriorityNormal; }
+
+    // abandons the command in flight, its send() returns false. Returns
+    // false if there is none or the adapter cannot cancel.
+    virtual bool cancel() { return false; }
+
 };
 
 /**
@@ -61,6 +122,32 @@ public:
 template <typename T>
 class CommandAdapter : public CommandAdapterBase {
 public:
+    static const size_t max_urc_handlers = 4;
+
+    // payload bytes hex encoded per write by sendPayload
+    static const size_t payload_chunk_size = 16;
+
+    // bytes buffered between the RX interrupt and the adapter's thread
+    static const size_t rx_ring_size = 1024;
+
+    // longest line taken from the modem, longer ones are split
+    static const size_t max_line_length = 600;
+
+    // msecs the response of an abandoned command is waited for (and
+    // dropped) before the next command is written, at most the next
+    // command's timeout
+    static const unsigned long default_late_response_window = 2000;
+
+    // threads with a priority other than PriorityNormal
+    static const size_t max_prioritized_threads = 8;
+
+    // number of command verbs whose latency is tracked
+    static const size_t max_timed_verbs = 16;
+
+    // limits of adaptive timeouts
+    static const unsigned long default_timeout_floor = 100;
+    static const unsigned long default_timeout_ceiling = 20000;
+
     CommandAdapter(T& modem);
     ~CommandAdapter();
 
@@ -68,34 +155,151 @@ public:
 
     bool send(const char *p_cmd, Callback<void(ModemResponse&)> cb, unsigned long timeout);
 
+    bool sendPayload(const char *p_header, const uint8_t *p_payload, size_t length, ModemResponse& r, unsigned long timeout);
+
+    bool addURCHandler(Callback<void(ModemResponse&)> cb);
+    bool removeURCHandler(Callback<void(ModemResponse&)> cb);
+
+    // commands of several threads are sent one at a time. Waiting
+    // commands go in order of their thread's priority, first come
+    // first served within a priority.
+    CommandPriority setCommandPriority(CommandPriority p);
+
+    bool priorityStats(CommandPriority p, PriorityStats& s) const;
+    void resetPriorityStats();
+
+    // Each command gets a sequence number when it is written. The modem
+    // answers in order, a completed response is tagged with the number of
+    // the command it answers. After a timeout or cancel() the number of the
+    // abandoned command is kept and its response is dropped when it comes,
+    // instead of being taken as the next command's response. The next
+    // command is written once that response came or the late response
+    // window ran out. AT responses carry no tag, one that comes after the
+    // window and after the next command was written cannot be told apart.
+    bool cancel();
+
+    // get/set msecs to wait for a late response, see above
+    unsigned long& lateResponseWindow() { return _late_response_window; }
+
+    void correlationStats(CorrelationStats& s) const;
+
     ModemCommandState get_state() const { return _state; };
 
+    // when enabled, the timeout of a command is derived from the latency
+    // observed for its verb (smoothed mean plus four times the variation),
+    // bounded by floor and ceiling, and doubled after each timeout. The
+    // timeout passed to send() is used until the verb has been measured,
+    // and always limits the wait for the adapter plus the response.
+    void setAdaptiveTimeouts(bool b_enable, unsigned long floor = default_timeout_floor,
+                             unsigned long ceiling = default_timeout_ceiling);
+
+    // latency observed for the verb of p_cmd, false if not measured
+    bool commandTiming(const char *p_cmd, CommandTiming& t) const;
+
+    // bytes dropped because the adapter's thread fell behind
+    unsigned long rxOverruns() const { return _rx_overruns; }
+
 protected:
     void reset_buf();
 
-    // attached to _modem, collects chars from modem in buffer. waits
-    // for EOL, forwards lines to _queue.
+    // attached to _modem, puts chars from modem into _ring. Wakes
+    // the thread at the end of each line.
     void recv_cb();
 
-    // waits on _queue. parses lines into a ModemResponse. Sends
-    // response to _mail
+    // takes chars from _ring, assembles lines in _line and parses them
     void thread_cb();
 
+    // parses a line into a ModemResponse. Sends response to _mail
+    void process_line(const string& line);
+
+    // writes command and (hex encoded) payload to modem, followed by CRLF
+    void write_command(const char *p_cmd, const uint8_t *p_payload = NULL, size_t length = 0);
+
     void set_state(ModemCommandState s) { _state = s; }
     bool ensure_state(ModemCommandState s, unsigned long timeout = 0);
 
     ModemResponseAlloc* get_current_response();
 
+    // passes an unsolicited response to all registered handlers
+    void dispatch_urc(ModemResponse& r);
+
+    struct Waiter {
+        CommandPriority     priority;
+        Semaphore           *p_sem;
+        bool                b_granted;          // adapter handed over by release()
+    };
+
+    struct ThreadPriority {
+        osThreadId          id;
+        CommandPriority     priority;
+    };
+
+    // priority of the calling thread
+    CommandPriority current_priority();
+
+    // expects the late response of command seq, if still in flight
+    void abandon(unsigned long seq, bool b_cancelled);
+
+    // frees responses in _mail left over from earlier commands
+    void drop_stale_responses();
+
+    // waits up to timeout msecs until the calling thread may send
+    bool acquire(CommandPriority p, unsigned long timeout);
+
+    // hands the adapter to the first waiter
+    void release();
+
+    // timing entry of the verb of p_cmd, NULL if not tracked. Adds an
+    // entry if b_add, replacing the least recently used one.
+    CommandTiming* find_timing(const char *p_cmd, bool b_add);
+
+    // timeout for p_cmd, adaptive if enabled
+    unsigned long adapt_timeout(const char *p_cmd, unsigned long timeout);
+
+    // updates the verb's latency after a command took ms, or timed out
+    void record_timing(const char *p_cmd, bool b_responded, unsigned long ms);
+
+    // waits for the adapter, then exchanges the command
+    ModemResponseAlloc* transact(const char *p_cmd, const uint8_t *p_payload, size_t length, unsigned long timeout);
+
+    // writes the command, waits for the response and returns it as
+    // allocated by _mail, NULL on timeout
+    ModemResponseAlloc* exchange(const char *p_cmd, const uint8_t *p_payload, size_t length, unsigned long timeout);
+
 private:
-    ModemCommandState               _state;
+    volatile ModemCommandState      _state;
 
     T&                              _modem;
-    CircularBuffer<char, 256>       _buf;                               // buffer characters from modem
-    Queue<string, 16>               _queue;                             // queues string lines coming back from modem
-    Thread                          _thread;                            // thread processes lines from _queue
+    SPSCRing<rx_ring_size>          _ring;                              // chars from modem, written by recv_cb only
+    size_t                          _rx_line_len;                       // chars of the current line pushed by recv_cb
+    volatile unsigned long          _rx_overruns;
+    char                            _line[max_line_length];             // line being assembled by thread_cb
+    size_t                          _line_len;
+    Thread                          _thread;                            // thread parses lines from _ring
     Mail<ModemResponseAlloc, 8>     _mail;                              // mailbox to receive ModemResponses
 
     ModemResponseAlloc              *_cur_response;                     // holds the response currently begin read from modem
+
+    Callback<void(ModemResponse&)>  _urc_handlers[max_urc_handlers];    // receive unsolicited responses
+
+    bool                            _b_adaptive;
+    unsigned long                   _timeout_floor;
+    unsigned long                   _timeout_ceiling;
+    CommandTiming                   _timings[max_timed_verbs];
+    unsigned long                   _timing_seq;
+
+    mutable Mutex                   _arb_mtx;                           // guards members below
+    bool                            _b_busy;                            // a thread is sending
+    list<Waiter*>                   _waiters;                           // by priority, then arrival
+    ThreadPriority                  _thread_priorities[max_prioritized_threads];
+    PriorityStats                   _priority_stats[command_priority_count];
+    CorrelationStats                _correlation_stats;
+
+    volatile unsigned long          _cmd_seq;                           // sequence number of the last command written
+    volatile unsigned long          _abandoned_seq;                     // command whose response is dropped, 0 if none
+    volatile bool                   _b_drop_partial;                    // thread_cb drops the response read so far
+    uint64_t                        _drain_until;                       // ms, end of draining_response
+    unsigned long                   _late_response_window;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,258 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#include <string.h>
+#include "compression.h"
+
+namespace Narrowband {
+
+static const size_t lzf_max_lit = 1 << 5;                      // literals per run
+static const size_t lzf_max_off = 1 << 13;                     // match distance
+static const size_t lzf_max_ref = (1 << 8) + (1 << 3);         // match length
+
+static inline unsigned int lzf_hash(const uint8_t *p) {
+    uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (v * 2654435761U) >> (32-lzf_hash_bits);
+}
+
+size_t lzf_compress(const uint8_t *p_in, size_t length, uint8_t *p_out, size_t sz_out, uint16_t *p_table) {
+    if ( length == 0 || sz_out == 0) {
+        return 0;
+    }
+    memset(p_table, 0, sizeof(uint16_t) << lzf_hash_bits);
+
+    const uint8_t *ip = p_in;
+    const uint8_t *in_end = p_in+length;
+    uint8_t *op = p_out;
+    uint8_t *out_end = p_out+sz_out;
+
+    // control byte of the current literal run, filled in when the run ends
+    uint8_t *p_ctrl = op++;
+    size_t lit = 0;
+
+    while ( ip < in_end) {
+        if ( ip+2 < in_end) {
+            unsigned int h = lzf_hash(ip);
+            const uint8_t *ref = p_in+p_table[h];
+            p_table[h] = (uint16_t)(ip-p_in);
+
+            size_t off = ip-ref-1;
+            if ( ref < ip && off < lzf_max_off && ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]) {
+                size_t maxlen = in_end-ip;
+                if ( maxlen > lzf_max_ref) {
+                    maxlen = lzf_max_ref;
+                }
+                size_t len = 3;
+                while ( len < maxlen && ref[len] == ip[len]) {
+                    len++;
+                }
+
+                // close literal run, drop its control byte if empty
+                if ( lit > 0) {
+                    *p_ctrl = (uint8_t)(lit-1);
+                } else {
+                    op--;
+                }
+
+                // up to 3 bytes for the match, 1 for the next control byte
+                if ( op+4 > out_end) {
+                    return 0;
+                }
+                size_t l = len-2;
+                if ( l < 7) {
+                    *op++ = (uint8_t)((off >> 8) + (l << 5));
+                } else {
+                    *op++ = (uint8_t)((off >> 8) + (7 << 5));
+                    *op++ = (uint8_t)(l-7);
+                }
+                *op++ = (uint8_t)off;
+
+                // remember positions inside the match, too
+                for ( const uint8_t *p = ip+1; p < ip+len && p+2 < in_end; p++) {
+                    p_table[lzf_hash(p)] = (uint16_t)(p-p_in);
+                }
+                ip += len;
+
+                p_ctrl = op++;
+                lit = 0;
+                continue;
+            }
+        }
+
+        if ( op >= out_end) {
+            return 0;
+        }
+        *op++ = *ip++;
+        lit++;
+        if ( lit == lzf_max_lit) {
+            *p_ctrl = (uint8_t)(lit-1);
+            if ( op >= out_end) {
+                return 0;
+            }
+            p_ctrl = op++;
+            lit = 0;
+        }
+    }
+
+    if ( lit > 0) {
+        *p_ctrl = (uint8_t)(lit-1);
+    } else {
+        op--;
+    }
+    return op-p_out;
+}
+
+size_t lzf_decompress(const uint8_t *p_in, size_t length, uint8_t *p_out, size_t sz_out) {
+    const uint8_t *ip = p_in;
+    const uint8_t *in_end = p_in+length;
+    uint8_t *op = p_out;
+    uint8_t *out_end = p_out+sz_out;
+
+    while ( ip < in_end) {
+        unsigned int ctrl = *ip++;
+
+        if ( ctrl < lzf_max_lit) {
+            // literal run
+            size_t n = ctrl+1;
+            if ( ip+n > in_end || op+n > out_end) {
+                return 0;
+            }
+            memcpy(op, ip, n);
+            ip += n;
+            op += n;
+        } else {
+            // back reference
+            size_t len = ctrl >> 5;
+            if ( len == 7) {
+                if ( ip >= in_end) {
+                    return 0;
+                }
+                len += *ip++;
+            }
+            len += 2;
+            if ( ip >= in_end) {
+                return 0;
+            }
+            size_t off = ((ctrl & 0x1f) << 8) + *ip++ + 1;
+            if ( off > (size_t)(op-p_out) || op+len > out_end) {
+                return 0;
+            }
+            // may overlap, copy bytewise
+            const uint8_t *ref = op-off;
+            while ( len-- > 0) {
+                *op++ = *ref++;
+            }
+        }
+    }
+    return op-p_out;
+}
+
+void delta_encode(const uint8_t *p_in, size_t length, size_t stride, uint8_t *p_out) {
+    for ( size_t i = 0; i < length; i++) {
+        p_out[i] = (i < stride || stride == 0)?p_in[i]:(uint8_t)(p_in[i]-p_in[i-stride]);
+    }
+}
+
+void delta_decode(uint8_t *p, size_t length, size_t stride) {
+    if ( stride == 0) {
+        return;
+    }
+    for ( size_t i = stride; i < length; i++) {
+        p[i] = (uint8_t)(p[i]+p[i-stride]);
+    }
+}
+
+// stride <-> header bits 2-3
+static uint8_t stride_code(size_t stride) {
+    switch (stride) {
+        case 1: return 1;
+        case 2: return 2;
+        case 4: return 3;
+        default: return 0;
+    }
+}
+
+static size_t code_stride(uint8_t code) {
+    static const size_t strides[4] = { 0, 1, 2, 4 };
+    return strides[code & 3];
+}
+
+Compressor::Compressor(size_t delta_stride) :
+    _delta_stride(code_stride(stride_code(delta_stride))), _size(0), _bytes_in(0), _bytes_out(0) {
+}
+
+bool Compressor::compress(const uint8_t *p_in, size_t length) {
+    if ( length > max_input || (p_in == NULL && length > 0)) {
+        return false;
+    }
+
+    const uint8_t *p_src = p_in;
+    uint8_t header = CompressionLZF;
+    if ( _delta_stride > 0) {
+        delta_encode(p_in, length, _delta_stride, _scratch);
+        p_src = _scratch;
+        header |= stride_code(_delta_stride) << 2;
+    }
+
+    // only worth it if smaller than storing
+    size_t n = (length > 1)?lzf_compress(p_src, length, _out+1, length-1, _table):0;
+    if ( n > 0) {
+        _out[0] = header;
+        _size = n+1;
+    } else {
+        _out[0] = CompressionStored;
+        if ( length > 0) {
+            memcpy(_out+1, p_in, length);
+        }
+        _size = length+1;
+    }
+
+    _bytes_in += length;
+    _bytes_out += _size;
+    return true;
+}
+
+bool Compressor::decompress(const uint8_t *p_in, size_t length, uint8_t *p_out, size_t sz_out, size_t& out_length) {
+    if ( length < 1) {
+        return false;
+    }
+    uint8_t header = p_in[0];
+
+    if ( (header & 3) == CompressionStored) {
+        if ( length-1 > sz_out) {
+            return false;
+        }
+        memcpy(p_out, p_in+1, length-1);
+        out_length = length-1;
+        return true;
+    }
+    if ( (header & 3) == CompressionLZF) {
+        size_t n = lzf_decompress(p_in+1, length-1, p_out, sz_out);
+        if ( n == 0) {
+            return false;
+        }
+        delta_decode(p_out, n, code_stride(header >> 2));
+        out_length = n;
+        return true;
+    }
+    return false;
+}
+
+}
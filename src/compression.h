@@ -0,0 +1,90 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Narrowband {
+
+// Payload compression for uplinks. Output starts with a header byte:
+//   bits 0-1   method, 0 = stored (payload follows as is), 1 = LZF
+//   bits 2-3   delta stride applied before LZF, 0 = none, 1/2/3 = 1/2/4 bytes
+// LZF data is compatible with liblzf's lzf_decompress, so the server
+// side can strip the header, decompress and undo the delta filter.
+
+enum CompressionMethod {
+    CompressionStored = 0x00,
+    CompressionLZF = 0x01
+};
+
+static const unsigned int lzf_hash_bits = 8;
+
+// compresses length bytes from p_in into p_out (LZF format), using
+// p_table (1<<lzf_hash_bits entries) as hash table. Returns size of
+// output, 0 if it does not fit into sz_out.
+size_t lzf_compress(const uint8_t *p_in, size_t length, uint8_t *p_out, size_t sz_out, uint16_t *p_table);
+
+// decompresses LZF data. Returns size of output, 0 if data is
+// corrupt or does not fit into sz_out.
+size_t lzf_decompress(const uint8_t *p_in, size_t length, uint8_t *p_out, size_t sz_out);
+
+// replaces each byte by its difference to the byte stride positions
+// before. Helps LZF on series of slowly changing numbers.
+void delta_encode(const uint8_t *p_in, size_t length, size_t stride, uint8_t *p_out);
+void delta_decode(uint8_t *p, size_t length, size_t stride);
+
+class Compressor {
+public:
+    // same as the largest UDP datagram (UDPSocketControl::max_payload)
+    static const size_t max_input = 1358;
+
+    // delta_stride is 0 (no delta filter), 1, 2 or 4. Use the
+    // width of the numbers in periodic binary telemetry.
+    Compressor(size_t delta_stride = 0);
+
+    // compresses length bytes, result is available through data()/size().
+    // Falls back to storing the payload if it does not get smaller.
+    bool compress(const uint8_t *p_in, size_t length);
+
+    const uint8_t *data() const { return _out; }
+    size_t size() const { return _size; }
+
+    // reverses compress(). Returns false on corrupt data or if
+    // output does not fit into sz_out.
+    static bool decompress(const uint8_t *p_in, size_t length, uint8_t *p_out, size_t sz_out, size_t& out_length);
+
+    // totals over all compress() calls
+    unsigned long bytesIn() const { return _bytes_in; }
+    unsigned long bytesOut() const { return _bytes_out; }
+
+private:
+    size_t          _delta_stride;
+    uint16_t        _table[1 << lzf_hash_bits];
+    uint8_t         _scratch[max_input];            // delta filtered input
+    uint8_t         _out[max_input+1];
+    size_t          _size;
+
+    unsigned long   _bytes_in;
+    unsigned long   _bytes_out;
+};
+
+}
@@ -20,6 +20,8 @@
 
 #include "controls.h"
 #include "modemresponse.h"
+#include "hexcodec.h"
+#include <stddef.h>
 
 namespace Narrowband {
 
@@ -456,7 +458,7 @@ NConfigControl::NConfigControl(CommandAdapterBase& cab) : ControlBase(cab) {
     read_timeout() = 5000;
 }
 
-NConfigControl::NConfigControl(const NConfigControl& rhs) : ControlBase(rhs) { }
+NConfigControl::NConfigControl(const NConfigControl& rhs) : ControlBase(rhs), _entries(rhs._entries), _writes(rhs._writes) { }
 
 bool NConfigControl::get() {
     if ( readable()) {
@@ -477,6 +479,7 @@ bool NConfigControl::get() {
                         _entries.insert(pair<string,string>(k,val));
                     }
                 }
+                return true;
             }
         }
     }
@@ -491,7 +494,9 @@ bool NConfigControl::set(string key, string value) {
 
         if (_cab.send(buf, r, _write_timeout)) {
             if (r.isOk()) {
-                get();
+                // modem takes the value as written, no need to read back
+                _entries[key] = value;
+                return true;
             }
         }
     }
@@ -499,6 +504,32 @@ bool NConfigControl::set(string key, string value) {
 
 }
 
+void NConfigControl::stage(string key, string value) {
+    _writes.push_back(NConfigWrite(key, value));
+}
+
+bool NConfigControl::commit() {
+    bool res = true;
+    for ( list<NConfigWrite>::iterator it = _writes.begin(); it != _writes.end(); ++it) {
+        if ( it->status != NConfigPending) {
+            continue;
+        }
+        std::map<string,string>::const_iterator e = _entries.find(it->key);
+        if ( e != _entries.end() && e->second == it->value) {
+            it->status = NConfigUnchanged;
+        } else if ( set(it->key, it->value)) {
+            it->status = NConfigWritten;
+        } else {
+            it->status = NConfigFailed;
+            res = false;
+        }
+    }
+    if ( res) {
+        _writes.clear();
+    }
+    return res;
+}
+
 
 
 ConnectionStatusControl::ConnectionStatusControl(CommandAdapterBase& cab) : ControlBase(cab) { }
@@ -617,9 +648,162 @@ AttachmentControl::AttachmentControl(const AttachmentControl& rhs) : OnOffContro
 
 
 
+SocketNotifications::SocketNotifications() {
+    for ( int i = 0; i < max_sockets; i++) {
+        _pending[i] = 0;
+    }
+}
+
+void SocketNotifications::on_urc(ModemResponse& r) {
+    string v;
+    if ( r.getCommandResponse("+NSONMI", v)) {
+        // +NSONMI:<socket>,<length>
+        int socket = atoi(v.c_str());
+        size_t n = v.find(',');
+        if ( n != string::npos && socket >= 0 && socket < max_sockets) {
+            _mtx.lock();
+            _pending[socket] += atoi(v.c_str()+n+1);
+            _mtx.unlock();
+
+            _sem[socket].release();
+        }
+    }
+}
+
+size_t SocketNotifications::pending(int socket) {
+    if ( socket < 0 || socket >= max_sockets) {
+        return 0;
+    }
+    _mtx.lock();
+    size_t res = _pending[socket];
+    _mtx.unlock();
+    return res;
+}
+
+void SocketNotifications::consumed(int socket, size_t n) {
+    if ( socket < 0 || socket >= max_sockets) {
+        return;
+    }
+    _mtx.lock();
+    _pending[socket] = (n < _pending[socket])?_pending[socket]-n:0;
+    _mtx.unlock();
+}
+
+void SocketNotifications::clear(int socket) {
+    if ( socket < 0 || socket >= max_sockets) {
+        return;
+    }
+    _mtx.lock();
+    _pending[socket] = 0;
+    _mtx.unlock();
+}
+
+bool SocketNotifications::wait(int socket, unsigned long timeout) {
+    if ( socket < 0 || socket >= max_sockets) {
+        return false;
+    }
+    uint64_t start = Kernel::get_ms_count();
+    while ( pending(socket) == 0) {
+        uint64_t elapsed = Kernel::get_ms_count()-start;
+        if ( elapsed >= timeout) {
+            return false;
+        }
+        _sem[socket].wait(timeout-elapsed);
+    }
+    return true;
+}
+
+
+
+RegistrationNotifications::RegistrationNotifications() : _status(-1), _notified(-1), _changed_at(0) {
+}
+
+void RegistrationNotifications::on_urc(ModemResponse& r) {
+    string v;
+    if ( r.getCommandResponse("+CEREG", v)) {
+        // +CEREG:<stat>[,<tac>,<ci>,<AcT>]
+        update(atoi(v.c_str()));
+    }
+}
+
+int RegistrationNotifications::status() {
+    _mtx.lock();
+    int res = _status;
+    _mtx.unlock();
+    return res;
+}
+
+uint64_t RegistrationNotifications::changedAt() {
+    _mtx.lock();
+    uint64_t res = _changed_at;
+    _mtx.unlock();
+    return res;
+}
+
+void RegistrationNotifications::update(int status) {
+    uint64_t now = Kernel::get_ms_count();
+
+    // test and set, so that a query and a URC with the same
+    // status do not both notify
+    _mtx.lock();
+    bool b_changed = (status != _notified);
+    _notified = status;
+    Callback<void(int)> cb = _cb;
+    _mtx.unlock();
+
+    if ( !b_changed) {
+        return;
+    }
+
+    // callback first, so that it has run when wait() returns
+    if ( cb) {
+        cb(status);
+    }
+
+    _mtx.lock();
+    _status = status;
+    _changed_at = now;
+    _mtx.unlock();
+    _sem.release();
+}
+
+void RegistrationNotifications::reset() {
+    _mtx.lock();
+    _status = -1;
+    _notified = -1;
+    _changed_at = 0;
+    _mtx.unlock();
+}
+
+void RegistrationNotifications::onChange(Callback<void(int)> cb) {
+    _mtx.lock();
+    _cb = cb;
+    _mtx.unlock();
+}
+
+bool RegistrationNotifications::wait(unsigned long timeout) {
+    uint64_t start = Kernel::get_ms_count();
+    while ( true) {
+        int s = status();
+        if ( isRegistered(s)) {
+            return true;
+        }
+        if ( s == 3) {
+            return false;
+        }
+        uint64_t elapsed = Kernel::get_ms_count()-start;
+        if ( elapsed >= timeout) {
+            return false;
+        }
+        _sem.wait(timeout-elapsed);
+    }
+}
+
+
+
 SocketControl::SocketControl(CommandAdapterBase& cab) : ControlBase(cab) {
     _localPort = -1;
-    _socket = 0;
+    _socket = -1;
     _bReceiveControl = false;
 }
 
@@ -638,7 +822,7 @@ SocketControl::~SocketControl() {
 long SocketControl::socket_id_ctr = rand()%32767;
 
 bool SocketControl::open() {
-    if ( _socket > 0) {
+    if ( isOpen()) {
         return false;       // already open
     }
 
@@ -650,21 +834,20 @@ bool SocketControl::open() {
     snprintf(buf,sizeof(buf), "AT+NSOCR=%s,%d,%d,%d", getType(), getProtocol(), _localPort, _bReceiveControl?1:0);
 
     if (_cab.send(buf, r, _write_timeout)) {
-        if (r.isOk()) {
+        if (r.isOk() && r.getResponses().size() > 0) {
 
             string socketID = *(r.getResponses().begin());
             _socket = atoi(socketID.c_str());
 
             return true;
-        } else {
-            _localPort = -1;
         }
     }
+    _localPort = -1;
     return false;
 }
 
 bool SocketControl::close() {
-    if ( _socket <= 0) {
+    if ( !isOpen()) {
         return false;
     }
 
@@ -674,8 +857,7 @@ bool SocketControl::close() {
 
     if (_cab.send(buf, r, _write_timeout)) {
         if (r.isOk()) {
-            _localPort = -1;
-            _socket = 0;
+            invalidate();
             return true;
         }
     }
@@ -684,47 +866,318 @@ bool SocketControl::close() {
 
 
 
-UDPSocketControl::UDPSocketControl(CommandAdapterBase& cab) : SocketControl(cab) {
+UDPSocketControl::UDPSocketControl(CommandAdapterBase& cab, SocketNotifications *p_notifications) : 
+    SocketControl(cab), _p_notifications(p_notifications) {
+}
+
+UDPSocketControl::UDPSocketControl(const UDPSocketControl& rhs) : SocketControl(rhs), _p_notifications(rhs._p_notifications) {
+}
+
+bool UDPSocketControl::open() {
+    if ( SocketControl::open()) {
+        // forget notifications left over from a previous socket with this id
+        if ( _p_notifications != NULL) {
+            _p_notifications->clear(_socket);
+        }
+        return true;
+    }
+    return false;
 }
 
-UDPSocketControl::UDPSocketControl(const UDPSocketControl& rhs) : SocketControl(rhs) {
+bool UDPSocketControl::close() {
+    int socket = _socket;
+    if ( SocketControl::close()) {
+        if ( _p_notifications != NULL) {
+            _p_notifications->clear(socket);
+        }
+        return true;
+    }
+    return false;
 }
 
 bool UDPSocketControl::sendTo(const char *remoteAddr, unsigned int remotePort, size_t length, const uint8_t *p_data) {
-    if ( length > 1358) {
-        return false;   // to large. 
+    return send_datagram(remoteAddr, remotePort, length, p_data, UDPSendFlagNone) == UDPSendOk;
+}
+
+bool UDPSocketControl::sendTo(const char *remoteAddr, unsigned int remotePort, size_t length, const uint8_t *p_data, int flags) {
+    return send_datagram(remoteAddr, remotePort, length, p_data, flags) == UDPSendOk;
+}
+
+size_t UDPSocketControl::sendBatch(UDPDatagram *p_datagrams, size_t n) {
+    size_t res = 0;
+    for ( size_t i = 0; i < n; i++) {
+        p_datagrams[i].status = UDPSendNotSent;
     }
-    size_t n = 1+length*2;
-    char *hexbuf = (char*)malloc(n); 
-    memset(hexbuf,0,n);
+    for ( size_t i = 0; i < n; i++) {
+        UDPDatagram& d = p_datagrams[i];
+        d.status = send_datagram(d.remoteAddr, d.remotePort, d.length, d.p_data, d.flags);
+        if ( d.status != UDPSendOk) {
+            break;
+        }
+        res++;
+    }
+    return res;
+}
 
-    char *q = hexbuf;
-    for ( size_t i = 0; i < length; i++) {
-        sprintf(q, "%.2X", p_data[i]);
-        q += 2;
+UDPSendStatus UDPSocketControl::send_datagram(const char *remoteAddr, unsigned int remotePort, size_t length, const uint8_t *p_data, int flags) {
+    if ( length > max_payload || remoteAddr == NULL || (p_data == NULL && length > 0)) {
+        return UDPSendInvalid;
     }
 
+    // payload is hex encoded by the adapter while sending
     ModemResponse r;
-    char buf[2048];
-    snprintf(buf,sizeof(buf), "AT+NSOST=%d,%s,%d,%d,%s", _socket, remoteAddr, remotePort, length, hexbuf);
-    free(hexbuf);
-
-    if (_cab.send(buf, r, _write_timeout)) {
-        if (r.isOk() && r.getResponses().size() > 0) {
-            string resp = *(r.getResponses().begin());
+    char buf[64];
+    int n;
+    if ( flags == UDPSendFlagNone) {
+        n = snprintf(buf,sizeof(buf), "AT+NSOST=%d,%s,%u,%u,", _socket, remoteAddr, remotePort, (unsigned int)length);
+    } else {
+        n = snprintf(buf,sizeof(buf), "AT+NSOSTF=%d,%s,%u,0x%X,%u,", _socket, remoteAddr, remotePort, flags, (unsigned int)length);
+    }
+    if ( n < 0 || n >= (int)sizeof(buf)) {
+        return UDPSendInvalid;
+    }
 
+    if (_cab.sendPayload(buf, p_data, length, r, _write_timeout)) {
+        if (r.isOk()) {
             // simple check. We expect everything to be sent.
             char buf[32];
-            snprintf(buf,sizeof(buf), "%d,%d",_socket,length);
+            snprintf(buf,sizeof(buf), "%d,%u",_socket,(unsigned int)length);
+
+            return r.hasResponse(buf)?UDPSendOk:UDPSendIncomplete;
+        }
+    }
+    return UDPSendError;
+}
+
+bool UDPSocketControl::recvFrom(size_t sz_buf, uint8_t *p_buf, string& remoteAddr, unsigned int& remotePort, size_t& length, size_t& remaining) {
+    length = 0;
+    remaining = 0;
+    if ( !isOpen() || sz_buf == 0 || p_buf == NULL) {
+        return false;
+    }
+    if ( _p_notifications != NULL && _p_notifications->pending(_socket) == 0) {
+        return false;   // nothing notified, do not poll the modem
+    }
+
+    bool res = false;
+    while ( length < sz_buf) {
+        size_t req = sz_buf-length;
+        if ( req > max_recv_chunk) {
+            req = max_recv_chunk;
+        }
+
+        ModemResponse r;
+        char buf[32];
+        snprintf(buf,sizeof(buf), "AT+NSORF=%d,%u", _socket, (unsigned int)req);
+
+        if ( !_cab.send(buf, r, _read_timeout) || !r.isOk()) {
+            break;
+        }
+
+        // <socket>,<ip_addr>,<port>,<length>,<data>,<remaining_length>
+        // skip echo, if any
+        const char *p = NULL;
+        for ( list<string>::iterator it = r.getResponses().begin(); it != r.getResponses().end(); ++it) {
+            if ( it->length() > 0 && (*it)[0] >= '0' && (*it)[0] <= '9') {
+                p = it->c_str();
+                break;
+            }
+        }
+        if ( p == NULL) {
+            // nothing (more) waiting in the modem
+            if ( _p_notifications != NULL) {
+                _p_notifications->clear(_socket);
+            }
+            break;
+        }
+
+        const char *p_addr = strchr(p, ',');
+        const char *p_port = (p_addr != NULL)?strchr(p_addr+1, ','):NULL;
+        const char *p_len = (p_port != NULL)?strchr(p_port+1, ','):NULL;
+        const char *p_data = (p_len != NULL)?strchr(p_len+1, ','):NULL;
+        if ( p_data == NULL) {
+            break;
+        }
+        p_addr++; p_port++; p_len++; p_data++;
+
+        size_t n = strtoul(p_len, NULL, 10);
+        if ( n > req) {
+            break;
+        }
+
+        // decode straight into the caller's buffer
+        const char *p_rem = strchr(p_data, ',');
+        if ( p_rem == NULL || (size_t)(p_rem-p_data) != 2*n || !hex_decode(p_data, n, p_buf+length)) {
+            break;
+        }
+        remaining = strtoul(p_rem+1, NULL, 10);
 
-            return ( resp == buf);
+        if ( length == 0) {
+            remoteAddr.assign(p_addr, p_port-1-p_addr);
+            remotePort = strtoul(p_port, NULL, 10);
         }
+        length += n;
+        res = true;
+
+        if ( _p_notifications != NULL) {
+            _p_notifications->consumed(_socket, n);
+        }
+
+        if ( remaining == 0 || n == 0) {
+            break;      // datagram complete
+        }
+    }
+    return res;
+}
+
+size_t UDPSocketControl::pending() {
+    if ( _p_notifications != NULL && isOpen()) {
+        return _p_notifications->pending(_socket);
+    }
+    return 0;
+}
+
+bool UDPSocketControl::waitForData(unsigned long timeout) {
+    if ( _p_notifications != NULL && isOpen()) {
+        return _p_notifications->wait(_socket, timeout);
     }
     return false;
 }
 
-bool UDPSocketControl::recvFrom(size_t sz_buf, uint8_t *p_buf, string& remoteAddr, unsigned int& remotePort, size_t length) {
+NUEStatsControl::NUEStatsControl(CommandAdapterBase& cab) : ControlBase(cab, true, false) { }
+
+NUEStatsControl::NUEStatsControl(const NUEStatsControl& rhs) : ControlBase(rhs) { }
+
+static const NUEStatsControl::field radio_fields[] = {
+    { "Signal power", offsetof(NUEStatsRadio, signal_power) },
+    { "Total power", offsetof(NUEStatsRadio, total_power) },
+    { "TX power", offsetof(NUEStatsRadio, tx_power) },
+    { "TX time", offsetof(NUEStatsRadio, tx_time) },
+    { "RX time", offsetof(NUEStatsRadio, rx_time) },
+    { "Cell ID", offsetof(NUEStatsRadio, cell_id) },
+    { "ECL", offsetof(NUEStatsRadio, ecl) },
+    { "SNR", offsetof(NUEStatsRadio, snr) },
+    { "EARFCN", offsetof(NUEStatsRadio, earfcn) },
+    { "PCI", offsetof(NUEStatsRadio, pci) },
+    { "RSRQ", offsetof(NUEStatsRadio, rsrq) },
+    { NULL, 0 }
+};
+
+static const NUEStatsControl::field bler_fields[] = {
+    { "RLC UL BLER", offsetof(NUEStatsBLER, rlc_ul_bler) },
+    { "RLC DL BLER", offsetof(NUEStatsBLER, rlc_dl_bler) },
+    { "MAC UL BLER", offsetof(NUEStatsBLER, mac_ul_bler) },
+    { "MAC DL BLER", offsetof(NUEStatsBLER, mac_dl_bler) },
+    { "MAC UL total bytes", offsetof(NUEStatsBLER, mac_ul_bytes) },
+    { "MAC DL total bytes", offsetof(NUEStatsBLER, mac_dl_bytes) },
+    { "MAC UL total HARQ Tx", offsetof(NUEStatsBLER, mac_ul_harq_tx) },
+    { "MAC DL total HARQ Tx", offsetof(NUEStatsBLER, mac_dl_harq_tx) },
+    { "MAC UL HARQ re-Tx", offsetof(NUEStatsBLER, mac_ul_harq_retx) },
+    { "MAC DL HARQ re-Tx", offsetof(NUEStatsBLER, mac_dl_harq_retx) },
+    { NULL, 0 }
+};
+
+static const NUEStatsControl::field thp_fields[] = {
+    { "RLC UL", offsetof(NUEStatsTHP, rlc_ul) },
+    { "RLC DL", offsetof(NUEStatsTHP, rlc_dl) },
+    { "MAC UL", offsetof(NUEStatsTHP, mac_ul) },
+    { "MAC DL", offsetof(NUEStatsTHP, mac_dl) },
+    { NULL, 0 }
+};
+
+// NUESTATS:CELL values in order of the line
+static int32_t NUEStatsCell::* const cell_fields[] = {
+    &NUEStatsCell::earfcn,
+    &NUEStatsCell::pci,
+    &NUEStatsCell::primary,
+    &NUEStatsCell::rsrp,
+    &NUEStatsCell::rsrq,
+    &NUEStatsCell::rssi,
+    &NUEStatsCell::snr
+};
+
+// skips "NUESTATS:<type>," of a line, returns NULL if line is of another type
+static const char *nuestats_skip_prefix(const char *p, const char *p_type) {
+    static const char prefix[] = "NUESTATS:";
+    if ( strncmp(p, prefix, sizeof(prefix)-1) != 0) {
+        return p;
+    }
+    p += sizeof(prefix)-1;
+    size_t n = strlen(p_type);
+    if ( strncmp(p, p_type, n) != 0 || p[n] != ',') {
+        return NULL;
+    }
+    return p+n+1;
+}
+
+bool NUEStatsControl::get_fields(const char *p_type, const field *p_fields, void *p_struct) const {
+    if ( !readable()) {
+        return false;
+    }
+    char cmd[32];
+    snprintf(cmd, sizeof(cmd), "AT+NUESTATS=%s", p_type);
+
+    ModemResponse r;
+    if ( !_cab.send(cmd, r, _read_timeout) || !r.isOk()) {
+        return false;
+    }
+
+    // lines are "NUESTATS:<type>,<label>,<value>", or
+    // "<label>:<value>" on older firmware
+    list<string>& lines = r.getResponses();
+    for ( list<string>::const_iterator it = lines.begin(); it != lines.end(); ++it) {
+        const char *p = nuestats_skip_prefix(it->c_str(), p_type);
+        if ( p == NULL) {
+            continue;
+        }
+        for ( const field *f = p_fields; f->p_label != NULL; f++) {
+            size_t n = strlen(f->p_label);
+            if ( strncmp(p, f->p_label, n) == 0 && (p[n] == ',' || p[n] == ':')) {
+                *(int32_t*)((uint8_t*)p_struct+f->offset) = (int32_t)strtol(p+n+1, NULL, 10);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+bool NUEStatsControl::getRadio(NUEStatsRadio& v) const {
+    return get_fields("RADIO", radio_fields, &v);
+}
 
+bool NUEStatsControl::getBLER(NUEStatsBLER& v) const {
+    return get_fields("BLER", bler_fields, &v);
+}
+
+bool NUEStatsControl::getThroughput(NUEStatsTHP& v) const {
+    return get_fields("THP", thp_fields, &v);
+}
+
+bool NUEStatsControl::getCells(NUEStatsCell *p_cells, size_t max_cells, size_t& n) const {
+    n = 0;
+    if ( !readable()) {
+        return false;
+    }
+    ModemResponse r;
+    if ( !_cab.send("AT+NUESTATS=CELL", r, _read_timeout) || !r.isOk()) {
+        return false;
+    }
+
+    // NUESTATS:CELL,<earfcn>,<pci>,<primary>,<rsrp>,<rsrq>,<rssi>,<snr>
+    list<string>& lines = r.getResponses();
+    for ( list<string>::const_iterator it = lines.begin(); it != lines.end() && n < max_cells; ++it) {
+        const char *p = nuestats_skip_prefix(it->c_str(), "CELL");
+        if ( p == NULL || p == it->c_str()) {
+            continue;
+        }
+        char *p_end;
+        for ( size_t i = 0; i < sizeof(cell_fields)/sizeof(cell_fields[0]); i++) {
+            p_cells[n].*cell_fields[i] = (int32_t)strtol(p, &p_end, 10);
+            p = (*p_end == ',')?p_end+1:p_end;
+        }
+        n++;
+    }
+    return true;
 }
 
 SignalQualityControl::SignalQualityControl(CommandAdapterBase& cab) : StringControl(cab, "AT+CSQ", "", true, false) {
@@ -27,6 +27,8 @@ namespace Narrowband {
 
 class ControlBase {
 public:
+    // with adaptive timeouts (CommandAdapter::setAdaptiveTimeouts) these
+    // only apply until a command has been measured
     static unsigned int const default_read_timeout = 500;
     static unsigned int const default_write_timeout = 1000;
 
@@ -159,6 +161,21 @@ private:
     list<int> csv_to_intlist(string ) const;
 };
 
+enum NConfigWriteStatus {
+    NConfigPending = 0,
+    NConfigWritten,
+    NConfigUnchanged,               // value was set already
+    NConfigFailed
+};
+
+struct NConfigWrite {
+    string              key;
+    string              value;
+    NConfigWriteStatus  status;
+
+    NConfigWrite(string _key, string _value) : key(_key), value(_value), status(NConfigPending) { }
+};
+
 class NConfigControl : public ControlBase {
 public:
     NConfigControl(CommandAdapterBase& cab);
@@ -167,10 +184,29 @@ public:
     virtual bool get();
     const std::map<string,string>& get() const { return _entries; };
     const string& valueFor(string key) const { return _entries.at(key); };
+
+    // writes a single key, updates the map on success
     virtual bool set(string key, string value);
 
+    // queues a write for commit()
+    void stage(string key, string value);
+
+    // writes all staged keys in one pass. Keys the map already holds
+    // with the same value are skipped, so call get() once beforehand.
+    // The map is updated from the writes. Returns true if no write
+    // failed and clears the staged writes. On failure, per-key status
+    // is in writes() until discard().
+    bool commit();
+
+    // staged writes and their status after a failed commit()
+    const list<NConfigWrite>& writes() const { return _writes; }
+
+    // drops staged writes
+    void discard() { _writes.clear(); }
+
 private:
     std::map<string,string>     _entries;
+    list<NConfigWrite>          _writes;
 };
 
 class ConnectionStatusControl : public ControlBase {
@@ -208,6 +244,74 @@ public:
     bool detach() { return set(0); }
 };
 
+// keeps track of +NSONMI notifications, i.e. bytes that have been
+// received by the modem and are waiting to be read per socket.
+class SocketNotifications {
+public:
+    static const int max_sockets = 7;
+
+    SocketNotifications();
+
+    // URC handler, to be registered with the CommandAdapter
+    void on_urc(ModemResponse& r);
+
+    size_t pending(int socket);
+
+    // notes that n bytes have been read from socket
+    void consumed(int socket, size_t n);
+
+    // notes that no data is waiting on socket
+    void clear(int socket);
+
+    // waits up to timeout msecs for data to be waiting on socket
+    bool wait(int socket, unsigned long timeout);
+
+private:
+    Mutex       _mtx;
+    size_t      _pending[max_sockets];
+    Semaphore   _sem[max_sockets];
+};
+
+// keeps track of +CEREG notifications (AT+CEREG=1 or 2), i.e. changes
+// of the network registration status.
+class RegistrationNotifications {
+public:
+    RegistrationNotifications();
+
+    // URC handler, to be registered with the CommandAdapter
+    void on_urc(ModemResponse& r);
+
+    // latest status (as in AT+CEREG?), -1 if unknown
+    int status();
+
+    // ms (Kernel::get_ms_count()) of the latest status change
+    uint64_t changedAt();
+
+    // sets status, e.g. from a query. Notifies on change.
+    void update(int status);
+
+    // forgets status
+    void reset();
+
+    // cb is called with the new status on every change, from the
+    // CommandAdapter's thread. It must not send commands.
+    void onChange(Callback<void(int)> cb);
+
+    // waits up to timeout msecs for registration to complete, i.e.
+    // registered (1, 5) or denied (3). Returns true if registered.
+    bool wait(unsigned long timeout);
+
+    static bool isRegistered(int status) { return status == 1 || status == 5; }
+
+private:
+    Mutex                   _mtx;
+    int                     _status;
+    int                     _notified;              // latest status cb was called with
+    uint64_t                _changed_at;
+    Semaphore               _sem;
+    Callback<void(int)>     _cb;
+};
+
 class SocketControl : public ControlBase {
 public:
     SocketControl(CommandAdapterBase& cab);
@@ -222,7 +326,13 @@ public:
     virtual const char *getType() = 0;
     virtual int getProtocol() = 0;
 
-    bool isOpen() { return _socket != 0; }
+    bool isOpen() const { return _socket >= 0; }
+    int getSocket() const { return _socket; }
+    int getLocalPort() const { return _localPort; }
+
+    // forgets the socket without closing it on the modem, e.g.
+    // after a modem reboot dropped all sockets.
+    void invalidate() { _socket = -1; _localPort = -1; }
 
 protected:
     int     _localPort;
@@ -237,17 +347,157 @@ protected:
     }
 };
 
+enum UDPSendStatus {
+    UDPSendNotSent = 0,     // not attempted, batch stopped at an earlier one
+    UDPSendOk,              // accepted by the modem
+    UDPSendInvalid,         // rejected locally, e.g. too large
+    UDPSendIncomplete,      // modem accepted fewer bytes than given
+    UDPSendError            // modem returned an error or did not respond
+};
+
+// flags of AT+NSOSTF. Release assistance (RAI) lets the modem drop
+// the radio connection instead of waiting for the inactivity timer.
+enum UDPSendFlags {
+    UDPSendFlagNone = 0x000,
+    UDPSendFlagException = 0x100,                   // exception data, sent with high priority
+    UDPSendFlagReleaseAfterUplink = 0x200,          // RAI, release after this uplink
+    UDPSendFlagReleaseAfterFirstDownlink = 0x400    // RAI, release after the first downlink following this uplink
+};
+
+// one datagram of a batch send
+struct UDPDatagram {
+    const char      *remoteAddr;
+    unsigned int    remotePort;
+    size_t          length;
+    const uint8_t   *p_data;
+    int             flags;      // UDPSendFlags
+    UDPSendStatus   status;     // result, set by sendBatch
+
+    UDPDatagram(const char *_remoteAddr = NULL, unsigned int _remotePort = 0, size_t _length = 0, const uint8_t *_p_data = NULL, int _flags = UDPSendFlagNone) :
+        remoteAddr(_remoteAddr), remotePort(_remotePort), length(_length), p_data(_p_data), flags(_flags), status(UDPSendNotSent) { }
+};
+
 class UDPSocketControl : public SocketControl {
 public:
-    UDPSocketControl(CommandAdapterBase& cab);
+    // largest datagram accepted by AT+NSOST
+    static const size_t max_payload = 1358;
+
+    // largest chunk requested by a single AT+NSORF. The hex encoded
+    // response line has to fit the adapter's line buffer
+    // (CommandAdapter::max_line_length).
+    static const size_t max_recv_chunk = 256;
+
+    UDPSocketControl(CommandAdapterBase& cab, SocketNotifications *p_notifications = NULL);
     UDPSocketControl(const UDPSocketControl& rhs);
 
     bool sendTo(const char *remoteAddr, unsigned int remotePort, size_t length, const uint8_t *p_data);
+
+    // sends with AT+NSOSTF, flags is a combination of UDPSendFlags
+    bool sendTo(const char *remoteAddr, unsigned int remotePort, size_t length, const uint8_t *p_data, int flags);
+
+    // sends n datagrams in order, storing each result in its status. A
+    // convenience loop over sendTo(): each AT+NSOST waits for its reply,
+    // nothing is pipelined. Stops at the first datagram that is not sent
+    // completely (invalid, incomplete or error), later entries stay
+    // UDPSendNotSent. Returns number of datagrams sent, i.e. the index
+    // of the failed one.
+    size_t sendBatch(UDPDatagram *p_datagrams, size_t n);
     
-    bool recvFrom(size_t sz_buf, uint8_t *p_buf, string& remoteAddr, unsigned int& remotePort, size_t length);
+    // reads the next datagram (or as much of it as fits into p_buf).
+    // length receives the number of bytes stored, remaining the
+    // number of bytes of this datagram still waiting in the modem.
+    // Without +NSONMI notifications pending, returns false without
+    // querying the modem.
+    bool recvFrom(size_t sz_buf, uint8_t *p_buf, string& remoteAddr, unsigned int& remotePort, size_t& length, size_t& remaining);
+
+    // number of bytes notified by the modem and not yet read
+    size_t pending();
+
+    // waits up to timeout msecs for data to arrive
+    bool waitForData(unsigned long timeout);
+
+    virtual bool open();
+    virtual bool close();
 
     virtual const char *getType() { return "DGRAM"; };
     virtual int getProtocol() { return 17; }
+
+protected:
+    SocketNotifications     *_p_notifications;
+
+    UDPSendStatus send_datagram(const char *remoteAddr, unsigned int remotePort, size_t length, const uint8_t *p_data, int flags);
+};
+
+// AT+NUESTATS=RADIO, power in cBm, time in ms
+struct NUEStatsRadio {
+    int32_t     signal_power;               // RSRP
+    int32_t     total_power;
+    int32_t     tx_power;
+    int32_t     tx_time;                    // since boot
+    int32_t     rx_time;
+    int32_t     cell_id;
+    int32_t     ecl;                        // coverage enhancement level 0..2
+    int32_t     snr;                        // in cB
+    int32_t     earfcn;
+    int32_t     pci;
+    int32_t     rsrq;
+};
+
+// one line of AT+NUESTATS=CELL
+struct NUEStatsCell {
+    int32_t     earfcn;
+    int32_t     pci;
+    int32_t     primary;                    // 1 = serving cell
+    int32_t     rsrp;
+    int32_t     rsrq;
+    int32_t     rssi;
+    int32_t     snr;
+};
+
+// AT+NUESTATS=BLER, rates in 1/10 percent
+struct NUEStatsBLER {
+    int32_t     rlc_ul_bler;
+    int32_t     rlc_dl_bler;
+    int32_t     mac_ul_bler;
+    int32_t     mac_dl_bler;
+    int32_t     mac_ul_bytes;
+    int32_t     mac_dl_bytes;
+    int32_t     mac_ul_harq_tx;
+    int32_t     mac_dl_harq_tx;
+    int32_t     mac_ul_harq_retx;
+    int32_t     mac_dl_harq_retx;
+};
+
+// AT+NUESTATS=THP, bits per second
+struct NUEStatsTHP {
+    int32_t     rlc_ul;
+    int32_t     rlc_dl;
+    int32_t     mac_ul;
+    int32_t     mac_dl;
+};
+
+class NUEStatsControl : public ControlBase {
+public:
+    NUEStatsControl(CommandAdapterBase& cab);
+    NUEStatsControl(const NUEStatsControl& rhs);
+
+    // values not reported by the modem are left as they are
+    bool getRadio(NUEStatsRadio& ) const;
+    bool getBLER(NUEStatsBLER& ) const;
+    bool getThroughput(NUEStatsTHP& ) const;
+
+    // reads up to max_cells cells into p_cells, n is set to the number read
+    bool getCells(NUEStatsCell *p_cells, size_t max_cells, size_t& n) const;
+
+    // maps a label to an int32_t member
+    struct field {
+        const char  *p_label;
+        size_t      offset;
+    };
+
+protected:
+    // sends AT+NUESTATS=<p_type>, sets int32_t fields of p_struct by label
+    bool get_fields(const char *p_type, const field *p_fields, void *p_struct) const;
 };
 
 class SignalQualityControl : protected StringControl {
@@ -0,0 +1,50 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Narrowband {
+
+// Connection to one peer for datagram based protocols (CoAP, MQTT-SN).
+// Kept free of mbed so that protocols can be tested on the host.
+class DatagramTransport {
+public:
+    virtual ~DatagramTransport() { }
+
+    virtual bool send(const uint8_t *p_data, size_t length) = 0;
+
+    // waits up to timeout msecs for the next datagram from the peer and
+    // stores as much of it as fits into p_buf. Returns false on timeout.
+    virtual bool receive(uint8_t *p_buf, size_t sz_buf, size_t& length, unsigned long timeout) = 0;
+
+    // monotonic clock in msecs
+    virtual unsigned long now() = 0;
+
+    // largest datagram send() takes
+    virtual size_t maxDatagram() { return default_max_datagram; }
+
+    // UDPSocketControl::max_payload, the most any module takes
+    static const size_t default_max_datagram = 1358;
+};
+
+}
@@ -0,0 +1,129 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#include <string.h>
+#include "hexcodec.h"
+
+namespace Narrowband {
+
+// two hex characters for each byte value
+static const char hex_pairs[513] =
+    "000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"
+    "202122232425262728292A2B2C2D2E2F303132333435363738393A3B3C3D3E3F"
+    "404142434445464748494A4B4C4D4E4F505152535455565758595A5B5C5D5E5F"
+    "606162636465666768696A6B6C6D6E6F707172737475767778797A7B7C7D7E7F"
+    "808182838485868788898A8B8C8D8E8F909192939495969798999A9B9C9D9E9F"
+    "A0A1A2A3A4A5A6A7A8A9AAABACADAEAFB0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+    "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECFD0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+    "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEFF0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+// nibble value for each character, 0xFF if not a hex digit
+static const uint8_t hex_nibbles[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// byte i (in memory order) of a word loaded from memory
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define WORD_BYTE(w,i)      (((w) >> (24-8*(i))) & 0xFF)
+#else
+#define WORD_BYTE(w,i)      (((w) >> (8*(i))) & 0xFF)
+#endif
+
+size_t hex_encode(const uint8_t *p_data, size_t length, char *p_out) {
+    const uint8_t *p = p_data;
+    char *q = p_out;
+    size_t n = length;
+
+    // one word of input at a time, 8 characters of output
+    while ( n >= 4) {
+        uint32_t w;
+        memcpy(&w, p, 4);
+        memcpy(q,   hex_pairs+2*WORD_BYTE(w,0), 2);
+        memcpy(q+2, hex_pairs+2*WORD_BYTE(w,1), 2);
+        memcpy(q+4, hex_pairs+2*WORD_BYTE(w,2), 2);
+        memcpy(q+6, hex_pairs+2*WORD_BYTE(w,3), 2);
+        p += 4;
+        q += 8;
+        n -= 4;
+    }
+    while ( n > 0) {
+        memcpy(q, hex_pairs+2*(*p), 2);
+        p++;
+        q += 2;
+        n--;
+    }
+    return 2*length;
+}
+
+bool hex_decode(const char *p_hex, size_t length, uint8_t *p_out) {
+    const uint8_t *p = (const uint8_t*)p_hex;
+    uint8_t *q = p_out;
+    size_t n = length;
+
+    // invalid characters map to 0xFF, OR them up and check once per word
+    while ( n >= 4) {
+        uint8_t h0 = hex_nibbles[p[0]], l0 = hex_nibbles[p[1]];
+        uint8_t h1 = hex_nibbles[p[2]], l1 = hex_nibbles[p[3]];
+        uint8_t h2 = hex_nibbles[p[4]], l2 = hex_nibbles[p[5]];
+        uint8_t h3 = hex_nibbles[p[6]], l3 = hex_nibbles[p[7]];
+        if ( (h0 | l0 | h1 | l1 | h2 | l2 | h3 | l3) & 0xF0) {
+            return false;
+        }
+
+        uint32_t w = ((uint32_t)((h0 << 4) | l0) << (8*0)) |
+                     ((uint32_t)((h1 << 4) | l1) << (8*1)) |
+                     ((uint32_t)((h2 << 4) | l2) << (8*2)) |
+                     ((uint32_t)((h3 << 4) | l3) << (8*3));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        w = ((w & 0xFF) << 24) | ((w & 0xFF00) << 8) | ((w >> 8) & 0xFF00) | (w >> 24);
+#endif
+        memcpy(q, &w, 4);
+        p += 8;
+        q += 4;
+        n -= 4;
+    }
+    while ( n > 0) {
+        uint8_t h = hex_nibbles[p[0]], l = hex_nibbles[p[1]];
+        if ( (h | l) & 0xF0) {
+            return false;
+        }
+        *q++ = (uint8_t)((h << 4) | l);
+        p += 2;
+        n--;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,38 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Narrowband {
+
+// encodes length bytes from p_data as 2*length upper case hex
+// characters into p_out. Output is not terminated. Returns
+// number of characters written.
+size_t hex_encode(const uint8_t *p_data, size_t length, char *p_out);
+
+// decodes 2*length hex characters (upper or lower case) from p_hex
+// into length bytes at p_out. Returns false if an invalid character
+// was found, p_out is undefined then.
+bool hex_decode(const char *p_hex, size_t length, uint8_t *p_out);
+
+}
@@ -22,15 +22,24 @@
 #include "mockserial.h"
 
 
-MockSerial::MockSerial(unsigned int baud) : _baud(baud) {
+MockSerial::MockSerial(unsigned int baud) : _baud(baud), _latency(0) {
     reset();
     _thr.start(callback(this,&MockSerial::thread_func));
 }
 
 void MockSerial::reset() {
+    _mtx.lock();
     memset(put_buf, 0, sizeof(put_buf));
     p_put_buf = put_buf;
+    p_match = put_buf;
     thr_flag = false;
+    exchanges.clear();
+    expect_str = "";
+    pending_response = "";
+    exchange_active = false;
+    rules.clear();
+    _latency = 0;
+    _mtx.unlock();
 }
 
 void MockSerial::setResponse(const char *str) {
@@ -40,8 +49,31 @@ void MockSerial::setResponse(const char *str) {
     }    
 }
 
+void MockSerial::addExchange(const string &expect, const string &response) {
+    _mtx.lock();
+    if ( !exchange_active && !thr_flag) {
+        expect_str = expect;
+        pending_response = response;
+        exchange_active = true;
+    } else {
+        exchanges.push_back(make_pair(expect, response));
+    }
+    _mtx.unlock();
+}
+
+void MockSerial::addRule(const string &expect, const string &response) {
+    _mtx.lock();
+    rules.push_back(make_pair(expect, response));
+    _mtx.unlock();
+}
+
 int MockSerial::putc(int c) {
-    *p_put_buf++ = c;
+    _mtx.lock();
+    if ( p_put_buf < put_buf+sizeof(put_buf)-1) {
+        *p_put_buf++ = c;
+        *p_put_buf = 0;
+    }
+    _mtx.unlock();
     return 0;
 }
 
@@ -65,11 +97,75 @@ void MockSerial::attach(Callback<void()> func, SerialBase::IrqType type) {
     _func = func;
 }
 
+// matches complete text against pattern, '*' matches any
+// characters except line endings.
+bool MockSerial::matches(const char *pattern, const char *text) {
+    if ( *pattern == 0) {
+        return *text == 0;
+    }
+    if ( *pattern == '*') {
+        if ( matches(pattern+1, text)) {
+            return true;
+        }
+        if ( *text != 0 && *text != '\r' && *text != '\n') {
+            return matches(pattern, text+1);
+        }
+        return false;
+    }
+    if ( *pattern == *text) {
+        return matches(pattern+1, text+1);
+    }
+    return false;
+}
+
+bool MockSerial::match_rule(string &response) {
+    if ( rules.empty()) {
+        return false;
+    }
+    const char *p_eol = strchr(p_match, '\n');
+    if ( p_eol == NULL) {
+        return false;
+    }
+    string line(p_match, p_eol+1-p_match);
+    p_match += line.length();
+    if ( p_match == p_put_buf) {
+        // all output consumed, start over so the buffer never fills up
+        p_put_buf = p_match = put_buf;
+        *p_put_buf = 0;
+    }
+
+    for ( list<pair<string,string> >::iterator it = rules.begin(); it != rules.end(); ++it) {
+        if ( matches(it->first.c_str(), line.c_str())) {
+            response = it->second;
+            return true;
+        }
+    }
+    return false;
+}
+
 void MockSerial::thread_func() {
     for(;;) {
         if ( thr_flag == false) {
-            if ( expect_str == put_buf) {
-               thr_flag = true; 
+            string response;
+            _mtx.lock();
+            if ( (expect_str.length() > 0 || exchange_active) && matches(expect_str.c_str(), p_match)) {
+                thr_flag = true; 
+                p_match += strlen(p_match);
+                response = pending_response;
+                pending_response = "";
+            } else if ( !exchange_active && expect_str.length() == 0 && match_rule(response)) {
+                thr_flag = true;
+            }
+            _mtx.unlock();
+
+            if ( thr_flag) {
+                if ( _latency > 0) {
+                    wait_ms(_latency);
+                }
+                setResponse(response.c_str());
+            } else {
+                // nothing to answer yet, don't hog the cpu
+                Thread::wait(1);
             }
         } else {
             if ( !response_buf.empty()) {
@@ -77,7 +173,17 @@ void MockSerial::thread_func() {
 
                 wait_us((1000L*1000L)/_baud);
             } else {
+                _mtx.lock();
                 thr_flag = false;
+                expect_str = "";
+                exchange_active = false;
+                if ( exchanges.size() > 0) {
+                    expect_str = exchanges.front().first;
+                    pending_response = exchanges.front().second;
+                    exchange_active = true;
+                    exchanges.pop_front();
+                }
+                _mtx.unlock();
             }
         }
     }
@@ -22,6 +22,7 @@
 
 #include <mbed.h>
 #include <string>
+#include <list>
 
 class MockSerial {
 public:
@@ -41,21 +42,47 @@ public:
 
     void setResponse(const char *str);
 
+    // queues an expected command and its response. Exchanges are
+    // played in order, each one matching the output following the
+    // previously matched command. '*' in expect matches anything
+    // within a line. An empty expect sends response right away, to
+    // simulate unsolicited responses.
+    void addExchange(const string &expect, const string &response);
+
+    // answers every command line matching expect with response, as
+    // long as no exchange is queued. Rules are checked in the order
+    // they were added. Lines matching no rule are dropped unanswered.
+    void addRule(const string &expect, const string &response);
+
+    // msecs to wait before answering, e.g. the modem's time on air
+    void setLatency(unsigned long ms) { _latency = ms; }
+
     void baud(unsigned int b) { _baud = b; }
 
 protected:
     Callback<void()> _func;
     Thread          _thr;
 
-    char            put_buf[1024];
+    char            put_buf[4096];
     char            *p_put_buf; 
+    char            *p_match;                           // start of output to match against expect_str
 
     string          expect_str;
     bool            thr_flag;
-    CircularBuffer<char, 256>   response_buf;
+    CircularBuffer<char, 1024>  response_buf;
+    list<pair<string,string> >  exchanges;
+    string          pending_response;
+    bool            exchange_active;
+    list<pair<string,string> >  rules;
+    Mutex           _mtx;
 
     unsigned int    _baud;
+    unsigned long   _latency;
 
 private:
     void    thread_func();
+
+    // matches the next complete output line against the rules
+    bool    match_rule(string &response);
+    static bool matches(const char *pattern, const char *text);
 };
\ No newline at end of file
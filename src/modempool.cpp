@@ -0,0 +1,229 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#include <mbed.h>
+#include "modempool.h"
+
+namespace Narrowband {
+
+// AT+CSQ RSSI, unknown counts as no coverage
+static int coverage(const PooledModemStats& s) {
+    return (s.rssi < 0 || s.rssi == 99)?0:s.rssi;
+}
+
+// true if modem a should be preferred to modem b
+static bool is_better(const PooledModemStats& a, const PooledModemStats& b) {
+    if ( (a.attached == 1) != (b.attached == 1)) {
+        return a.attached == 1;
+    }
+    if ( a.in_flight != b.in_flight) {
+        return a.in_flight < b.in_flight;
+    }
+    if ( coverage(a) != coverage(b)) {
+        return coverage(a) > coverage(b);
+    }
+    return a.sent < b.sent;
+}
+
+ModemPool::ModemPool() : _count(0), _health_interval(default_health_interval) {
+    for ( size_t i = 0; i < max_modems; i++) {
+        _modems[i].p_nb = NULL;
+    }
+    resetStats();
+}
+
+bool ModemPool::add(Narrowband& nb) {
+    _mtx.lock();
+    if ( _count >= max_modems) {
+        _mtx.unlock();
+        return false;
+    }
+    PooledModem& m = _modems[_count++];
+    m.p_nb = &nb;
+    memset(&m.stats, 0, sizeof(m.stats));
+    m.stats.attached = -1;
+    m.stats.rssi = -1;
+    m.stats.b_healthy = true;
+    m.checked = 0;
+    _mtx.unlock();
+    return true;
+}
+
+int ModemPool::select(unsigned int tried, size_t length) {
+    _mtx.lock();
+    int best = -1;
+    for ( size_t i = 0; i < _count; i++) {
+        if ( (tried & (1 << i)) != 0 || !_modems[i].stats.b_healthy || length > _modems[i].p_nb->maxMessage()) {
+            continue;
+        }
+        if ( best < 0 || is_better(_modems[i].stats, _modems[best].stats)) {
+            best = (int)i;
+        }
+    }
+    if ( best >= 0) {
+        _modems[best].stats.in_flight++;
+        if ( tried != 0) {
+            _stats.failovers++;
+        }
+        if ( _started == 0) {
+            _started = Kernel::get_ms_count();
+        }
+    }
+    _mtx.unlock();
+    return best;
+}
+
+size_t ModemPool::max_message() const {
+    size_t res = 0;
+    for ( size_t i = 0; i < _count; i++) {
+        size_t n = _modems[i].p_nb->maxMessage();
+        if ( n > res) {
+            res = n;
+        }
+    }
+    return res;
+}
+
+bool ModemPool::sendUDP(const string& remoteAddr, unsigned int port, const string& body, int options) {
+    // too large for any modem, not a fault of one
+    _mtx.lock();
+    if ( body.length() > max_message()) {
+        _stats.failed++;
+        _stats.rejected++;
+        _mtx.unlock();
+        return false;
+    }
+    _mtx.unlock();
+
+    unsigned int tried = 0;
+    for (;;) {
+        int i = select(tried, body.length());
+        if ( i < 0) {
+            _mtx.lock();
+            _stats.failed++;
+            _mtx.unlock();
+            return false;
+        }
+        tried |= (1 << i);
+
+        PooledModem& m = _modems[i];
+        m.mtx.lock();
+        bool b = m.p_nb->sendUDP(remoteAddr, port, body, options);
+        SendError err = b?SendErrorNone:m.p_nb->sendError();
+        bool b_queued = b && m.p_nb->queued();
+        m.mtx.unlock();
+
+        _mtx.lock();
+        m.stats.in_flight--;
+        if ( b_queued) {
+            // goes out with the modem's outbox, later ones go elsewhere
+            m.stats.queued++;
+            m.stats.b_healthy = false;
+            _stats.queued++;
+        } else if ( b) {
+            m.stats.sent++;
+            m.stats.bytes += body.length();
+            _stats.sent++;
+            _stats.bytes += body.length();
+        } else if ( err == SendErrorModem) {
+            // skip until the next health check finds it attached
+            m.stats.failed++;
+            m.stats.b_healthy = false;
+        } else {
+            // refused without trying, another modem will not do better
+            _stats.failed++;
+            _stats.rejected++;
+        }
+        _mtx.unlock();
+
+        if ( b || err != SendErrorModem) {
+            return b;
+        }
+    }
+}
+
+bool ModemPool::checkHealth(size_t i) {
+    if ( i >= _count) {
+        return false;
+    }
+    PooledModem& m = _modems[i];
+
+    ModemStatus st;
+    m.mtx.lock();
+    bool b = m.p_nb->core().status(st);
+    m.mtx.unlock();
+
+    _mtx.lock();
+    m.checked = Kernel::get_ms_count();
+    m.stats.attached = b?st.attached:-1;
+    m.stats.rssi = b?st.rssi:-1;
+    bool b_healthy = b && st.attached == 1;
+    m.stats.b_healthy = b_healthy;
+    _mtx.unlock();
+    return b_healthy;
+}
+
+void ModemPool::poll() {
+    for ( size_t i = 0; i < _count; i++) {
+        _mtx.lock();
+        bool b_due = _modems[i].checked == 0 || Kernel::get_ms_count()-_modems[i].checked >= _health_interval;
+        _mtx.unlock();
+        if ( b_due) {
+            checkHealth(i);
+        }
+
+        _modems[i].mtx.lock();
+        _modems[i].p_nb->poll();
+        _modems[i].mtx.unlock();
+    }
+}
+
+bool ModemPool::modemStats(size_t i, PooledModemStats& s) const {
+    if ( i >= _count) {
+        return false;
+    }
+    _mtx.lock();
+    s = _modems[i].stats;
+    _mtx.unlock();
+    return true;
+}
+
+void ModemPool::stats(ModemPoolStats& s) const {
+    _mtx.lock();
+    s = _stats;
+    s.elapsed = (_started != 0)?(unsigned long)(Kernel::get_ms_count()-_started):0;
+    s.throughput = (s.elapsed > 0)?(unsigned long)(((uint64_t)s.bytes*1000)/s.elapsed):0;
+    _mtx.unlock();
+}
+
+void ModemPool::resetStats() {
+    _mtx.lock();
+    memset(&_stats, 0, sizeof(_stats));
+    _started = 0;
+    for ( size_t i = 0; i < _count; i++) {
+        _modems[i].stats.sent = 0;
+        _modems[i].stats.queued = 0;
+        _modems[i].stats.failed = 0;
+        _modems[i].stats.bytes = 0;
+    }
+    _mtx.unlock();
+}
+
+}
@@ -0,0 +1,122 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#pragma once
+
+#include "narrowband.h"
+#include <string>
+
+namespace Narrowband {
+
+// per modem counters of a ModemPool
+struct PooledModemStats {
+    unsigned long   sent;                   // datagrams accepted by this modem
+    unsigned long   queued;                 // datagrams left in this modem's outbox, not in sent
+    unsigned long   failed;                 // sends that failed on this modem
+    unsigned long   bytes;                  // payload bytes sent
+    unsigned int    in_flight;              // sends currently running
+    int             attached;               // last health check, 1 = attached, -1 if not checked
+    int             rssi;                   // last health check, AT+CSQ, -1 if not checked
+    bool            b_healthy;              // used for new sends
+};
+
+struct ModemPoolStats {
+    unsigned long   sent;                   // datagrams sent by any modem
+    unsigned long   queued;                 // datagrams a modem put into its outbox, not in sent
+    unsigned long   failed;                 // datagrams no modem could send
+    unsigned long   rejected;               // of failed, too large or refused before reaching a modem
+    unsigned long   failovers;              // sends retried on another modem
+    unsigned long   bytes;                  // payload bytes sent
+    unsigned long   elapsed;                // msecs since the first send after resetStats()
+    unsigned long   throughput;             // bytes/s over elapsed
+};
+
+// spreads uplinks across several modems, e.g. one per UART of a
+// gateway. Each datagram goes to the least loaded healthy modem, ties
+// are broken by coverage. A modem that fails a send (timeout, ERROR,
+// not attached) is skipped until poll() finds it attached again, the
+// datagram is retried on the next one. Datagrams a modem refuses
+// without trying, e.g. too large, fail without failover. A modem with
+// an outbox that queues a datagram instead of sending it keeps it
+// (counted as queued, not sent) and is skipped as a failed one is.
+// Sends to different modems run in parallel, each Narrowband instance
+// is only used by one thread at a time.
+class ModemPool {
+public:
+    static const size_t max_modems = 4;
+
+    // msecs between health checks (NarrowbandCore::status) in poll()
+    static const unsigned long default_health_interval = 30000;
+
+    ModemPool();
+
+    // adds a modem, returns false if the pool is full
+    bool add(Narrowband& nb);
+
+    size_t count() const { return _count; }
+
+    // sends through the best modem as Narrowband::sendUDP does, fails
+    // over to the others on modem failures. Thread safe.
+    bool sendUDP(const string& remoteAddr, unsigned int port, const string& body, int options = SendDefault);
+
+    // periodic housekeeping, checks the health of modems that are due
+    // and runs Narrowband::poll() on each.
+    void poll();
+
+    // checks health of modem i now
+    bool checkHealth(size_t i);
+
+    // get/set msecs between health checks
+    unsigned long& healthInterval() { return _health_interval; }
+
+    bool modemStats(size_t i, PooledModemStats& s) const;
+    void stats(ModemPoolStats& s) const;
+    void resetStats();
+
+protected:
+    struct PooledModem {
+        Narrowband          *p_nb;
+        Mutex               mtx;                        // held while a thread uses p_nb
+        PooledModemStats    stats;
+        uint64_t            checked;                    // ms, last health check, 0 if never
+    };
+
+    // picks the modem for the next send and counts it in flight,
+    // skips modems in tried (bit mask) and those that do not take
+    // length bytes. Returns -1 if there is none.
+    int select(unsigned int tried, size_t length);
+
+    // largest body any modem takes
+    size_t max_message() const;
+
+    PooledModem         _modems[max_modems];
+    size_t              _count;
+    mutable Mutex       _mtx;                           // guards stats and selection
+
+    unsigned long       _health_interval;
+    ModemPoolStats      _stats;
+    uint64_t            _started;                       // ms, first send after resetStats(), 0 if none
+
+private:
+    ModemPool(const ModemPool&);
+    ModemPool& operator=(const ModemPool&);
+};
+
+}
@@ -29,7 +29,7 @@ ModemResponse::ModemResponse() :
 
 ModemResponse::ModemResponse(ModemResponse& r) :
     b_ok(r.b_ok), b_error(r.b_error), b_unsolicited(r.b_unsolicited),
-    cmdresponses(r.cmdresponses), responses(r.responses), errcode(0) { }
+    cmdresponses(r.cmdresponses), responses(r.responses), errcode(r.errcode) { }
 
 bool ModemResponse::getCommandResponse(const string& key, string& value) {
     multimap<string,string>::iterator it = cmdresponses.find(key);
@@ -78,6 +78,7 @@ protected:
 
 struct ModemResponseAlloc {
     ModemResponse *obj;
+    unsigned long seq;      // command this answers, see CommandAdapter. obj is NULL if the command was cancelled.
 };
 
 ModemResponse* ModemResponse_init(ModemResponseAlloc *m);
@@ -0,0 +1,88 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace Narrowband {
+
+// optional commands, bit mask in ModuleProfile::commands
+enum ModuleCommand {
+    ModuleReleaseAssistance = 0x02,         // AT+NSOSTF, RAI flags on uplinks
+    ModuleRadioStats = 0x04,                // AT+NUESTATS
+    ModuleCommandChaining = 0x08            // several commands in one line, separated by ';'
+};
+
+// capabilities and limits of a module, see NarrowbandCoreFor
+struct ModuleProfile {
+    const char      *name;
+    unsigned int    commands;               // ModuleCommand bits supported
+    size_t          max_payload;            // bytes per datagram
+    const int       *p_bands;               // supported bands, 0 terminated, NULL if not known
+
+    bool supports(unsigned int cmd) const { return (commands & cmd) == cmd; }
+    bool supportsBand(int band) const {
+        if ( p_bands == NULL) {
+            return true;
+        }
+        for ( const int *p = p_bands; *p != 0; p++) {
+            if ( *p == band) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Compile-time profiles. NarrowbandCoreFor<P> turns one into the
+// ModuleProfile used by NarrowbandCore.
+
+// any module, everything allowed. The named profiles below share its
+// commands and only narrow what is documented per module: payload and
+// bands. Timeouts are the same for all modules (see NarrowbandCore).
+struct GenericProfile {
+    static const char *name() { return "generic"; }
+    static const unsigned int commands = ModuleReleaseAssistance | ModuleRadioStats | ModuleCommandChaining;
+    static const size_t max_payload = 1358;
+    static const int *bands() { return NULL; }
+};
+
+struct BC95Profile : public GenericProfile {
+    static const char *name() { return "Quectel BC95-B8"; }
+    static const size_t max_payload = 512;
+    static const int *bands() { static const int b[] = { 8, 0 }; return b; }
+};
+
+struct BC68Profile : public GenericProfile {
+    static const char *name() { return "Quectel BC68"; }
+    static const size_t max_payload = 512;
+    static const int *bands() { static const int b[] = { 1, 3, 5, 8, 20, 28, 0 }; return b; }
+};
+
+template <class P>
+const ModuleProfile& module_profile() {
+    static const ModuleProfile p = {
+        P::name(), P::commands, P::max_payload, P::bands()
+    };
+    return p;
+}
+
+}
@@ -0,0 +1,331 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#include "mqttsn.h"
+#include <string.h>
+
+namespace Narrowband {
+
+// PUBLISH/CONNECT flags
+static const uint8_t flag_dup = 0x80;
+static const uint8_t flag_qos1 = 0x20;
+static const uint8_t flag_qos_minus1 = 0x60;
+static const uint8_t flag_retain = 0x10;
+static const uint8_t flag_clean_session = 0x04;
+
+static const uint8_t protocol_id = 0x01;
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// splits a message into type and variable part
+static bool parse_message(const uint8_t *p, size_t n, uint8_t& type, const uint8_t *&p_body, size_t& body_length) {
+    size_t length, header;
+    if ( n >= 4 && p[0] == 0x01) {
+        length = get_u16(p+1);
+        header = 4;
+    } else if ( n >= 2) {
+        length = p[0];
+        header = 2;
+    } else {
+        return false;
+    }
+    if ( length < header || length > n) {
+        return false;
+    }
+    type = p[header-1];
+    p_body = p+header;
+    body_length = length-header;
+    return true;
+}
+
+MqttSnClient::MqttSnClient(DatagramTransport& transport, uint8_t *p_tx, size_t sz_tx, uint8_t *p_rx, size_t sz_rx) :
+    _transport(transport), _p_tx(p_tx), _sz_tx(sz_tx), _p_rx(p_rx), _sz_rx(sz_rx),
+    _b_connected(false), _msg_id(0), _next_topic(0), _registrations(0) {
+    clearTopics();
+}
+
+void MqttSnClient::clearTopics() {
+    for ( size_t i = 0; i < max_topics; i++) {
+        _topics[i].name[0] = 0;
+        _topics[i].id = 0;
+    }
+    _next_topic = 0;
+}
+
+uint16_t MqttSnClient::next_msg_id() {
+    if ( ++_msg_id == 0) {
+        _msg_id = 1;
+    }
+    return _msg_id;
+}
+
+uint8_t *MqttSnClient::begin_message(uint8_t type, size_t body_length, size_t& length) {
+    uint8_t *p = _p_tx;
+    if ( 2+body_length < 256) {
+        length = 2+body_length;
+        if ( length > _sz_tx) {
+            return NULL;
+        }
+        *p++ = (uint8_t)length;
+    } else {
+        length = 4+body_length;
+        if ( length > _sz_tx || length > 0xFFFF) {
+            return NULL;
+        }
+        *p++ = 0x01;
+        put_u16(p, (uint16_t)length);
+        p += 2;
+    }
+    *p++ = type;
+    return p;
+}
+
+const uint8_t *MqttSnClient::request(size_t length, uint8_t ack_type, uint16_t msg_id, size_t& ack_length, bool b_set_dup) {
+    for ( unsigned int attempt = 0; attempt < max_retries; attempt++) {
+        if ( attempt > 0 && b_set_dup) {
+            // flags follow the header of PUBLISH
+            _p_tx[(_p_tx[0] == 0x01)?4:2] |= flag_dup;
+        }
+        if ( !_transport.send(_p_tx, length)) {
+            return NULL;
+        }
+
+        unsigned long deadline = _transport.now()+retry_timeout;
+        while ( true) {
+            unsigned long now = _transport.now();
+            if ( (long)(now-deadline) >= 0) {
+                break;
+            }
+            size_t n = 0;
+            if ( !_transport.receive(_p_rx, _sz_rx, n, deadline-now)) {
+                break;
+            }
+            uint8_t type;
+            const uint8_t *p_body;
+            size_t body_length;
+            if ( !parse_message(_p_rx, n, type, p_body, body_length)) {
+                continue;
+            }
+            // REGACK and PUBACK carry the MsgId after the TopicId
+            if ( type == ack_type && (msg_id == 0 || (body_length >= 5 && get_u16(p_body+2) == msg_id))) {
+                ack_length = body_length;
+                return p_body;
+            }
+            handle_other(type, p_body, body_length);
+        }
+    }
+    return NULL;
+}
+
+void MqttSnClient::handle_other(uint8_t type, const uint8_t *p, size_t length) {
+    // p_tx may hold a message to be retried, answer from the stack
+    uint8_t ack[7];
+    if ( type == MqttSnRegister && length > 4) {
+        // topic registered by the gateway, e.g. for a wildcard subscription
+        uint16_t id = get_u16(p);
+        size_t name_length = length-4;
+        uint8_t rc = MqttSnRejectedNotSupported;
+        if ( name_length <= max_topic_length) {
+            char name[max_topic_length+1];
+            memcpy(name, p+4, name_length);
+            name[name_length] = 0;
+            add_topic(name, id);
+            rc = MqttSnAccepted;
+        }
+        ack[0] = 7;
+        ack[1] = MqttSnRegack;
+        put_u16(ack+2, id);
+        memcpy(ack+4, p+2, 2);
+        ack[6] = rc;
+        _transport.send(ack, 7);
+    } else if ( type == MqttSnPublish && length >= 5 && (p[0] & 0x60) == flag_qos1) {
+        // nothing subscribed, acknowledge so the gateway does not retry
+        ack[0] = 7;
+        ack[1] = MqttSnPuback;
+        memcpy(ack+2, p+1, 4);
+        ack[6] = MqttSnAccepted;
+        _transport.send(ack, 7);
+    }
+}
+
+bool MqttSnClient::connect(const char *p_client_id, uint16_t keep_alive, bool b_clean_session) {
+    size_t id_length = strlen(p_client_id);
+    size_t length;
+    uint8_t *p = begin_message(MqttSnConnect, 4+id_length, length);
+    if ( p == NULL) {
+        return false;
+    }
+    p[0] = b_clean_session?flag_clean_session:0;
+    p[1] = protocol_id;
+    put_u16(p+2, keep_alive);
+    memcpy(p+4, p_client_id, id_length);
+
+    size_t ack_length;
+    const uint8_t *p_ack = request(length, MqttSnConnack, 0, ack_length);
+    _b_connected = (p_ack != NULL && ack_length >= 1 && p_ack[0] == MqttSnAccepted);
+    if ( _b_connected && b_clean_session) {
+        clearTopics();
+    }
+    return _b_connected;
+}
+
+bool MqttSnClient::disconnect() {
+    size_t length, ack_length;
+    begin_message(MqttSnDisconnect, 0, length);
+    bool res = request(length, MqttSnDisconnect, 0, ack_length) != NULL;
+    _b_connected = false;
+    return res;
+}
+
+bool MqttSnClient::ping() {
+    size_t length, ack_length;
+    begin_message(MqttSnPingreq, 0, length);
+    return request(length, MqttSnPingresp, 0, ack_length) != NULL;
+}
+
+MqttSnClient::Topic *MqttSnClient::find_topic(const char *p_topic) {
+    for ( size_t i = 0; i < max_topics; i++) {
+        if ( _topics[i].name[0] != 0 && strcmp(_topics[i].name, p_topic) == 0) {
+            return &_topics[i];
+        }
+    }
+    return NULL;
+}
+
+void MqttSnClient::add_topic(const char *p_topic, uint16_t id) {
+    Topic *t = find_topic(p_topic);
+    if ( t == NULL) {
+        t = &_topics[_next_topic];
+        _next_topic = (_next_topic+1) % max_topics;
+    }
+    strncpy(t->name, p_topic, max_topic_length);
+    t->name[max_topic_length] = 0;
+    t->id = id;
+}
+
+void MqttSnClient::remove_topic(uint16_t id) {
+    for ( size_t i = 0; i < max_topics; i++) {
+        if ( _topics[i].name[0] != 0 && _topics[i].id == id) {
+            _topics[i].name[0] = 0;
+        }
+    }
+}
+
+bool MqttSnClient::registerTopic(const char *p_topic, uint16_t& topic_id) {
+    Topic *t = find_topic(p_topic);
+    if ( t != NULL) {
+        topic_id = t->id;
+        return true;
+    }
+
+    size_t name_length = strlen(p_topic);
+    if ( !_b_connected || name_length > max_topic_length) {
+        return false;
+    }
+    size_t length;
+    uint8_t *p = begin_message(MqttSnRegister, 4+name_length, length);
+    if ( p == NULL) {
+        return false;
+    }
+    uint16_t msg_id = next_msg_id();
+    put_u16(p, 0);
+    put_u16(p+2, msg_id);
+    memcpy(p+4, p_topic, name_length);
+
+    _registrations++;
+    size_t ack_length;
+    const uint8_t *p_ack = request(length, MqttSnRegack, msg_id, ack_length);
+    if ( p_ack == NULL || p_ack[4] != MqttSnAccepted) {
+        return false;
+    }
+    topic_id = get_u16(p_ack);
+    add_topic(p_topic, topic_id);
+    return true;
+}
+
+bool MqttSnClient::send_publish(uint8_t id_type, uint16_t topic_id, const uint8_t *p_data, size_t length, int qos, bool b_retain, uint8_t& rc) {
+    rc = MqttSnAccepted;
+    if ( qos < -1 || qos > 1 || (qos >= 0 && !_b_connected)) {
+        return false;
+    }
+
+    size_t msg_length;
+    uint8_t *p = begin_message(MqttSnPublish, 5+length, msg_length);
+    if ( p == NULL) {
+        return false;
+    }
+    uint16_t msg_id = (qos == 1)?next_msg_id():0;
+    p[0] = (uint8_t)(((qos == 1)?flag_qos1:(qos == -1)?flag_qos_minus1:0) | (b_retain?flag_retain:0) | id_type);
+    put_u16(p+1, topic_id);
+    put_u16(p+3, msg_id);
+    memcpy(p+5, p_data, length);
+
+    if ( qos < 1) {
+        return _transport.send(_p_tx, msg_length);
+    }
+
+    size_t ack_length;
+    const uint8_t *p_ack = request(msg_length, MqttSnPuback, msg_id, ack_length, true);
+    if ( p_ack == NULL) {
+        return false;
+    }
+    rc = p_ack[4];
+    return rc == MqttSnAccepted;
+}
+
+bool MqttSnClient::publish(const char *p_topic, const uint8_t *p_data, size_t length, int qos, bool b_retain) {
+    uint8_t rc;
+    if ( strlen(p_topic) == 2) {
+        return send_publish(TopicShortName, get_u16((const uint8_t*)p_topic), p_data, length, qos, b_retain, rc);
+    }
+    if ( qos == -1) {
+        return false;
+    }
+
+    // the gateway may have lost our registration, register once more
+    for ( int attempt = 0; attempt < 2; attempt++) {
+        uint16_t topic_id;
+        if ( !registerTopic(p_topic, topic_id)) {
+            return false;
+        }
+        if ( send_publish(TopicNormal, topic_id, p_data, length, qos, b_retain, rc)) {
+            return true;
+        }
+        if ( rc != MqttSnRejectedInvalidTopicId) {
+            return false;
+        }
+        remove_topic(topic_id);
+    }
+    return false;
+}
+
+bool MqttSnClient::publishPredefined(uint16_t topic_id, const uint8_t *p_data, size_t length, int qos, bool b_retain) {
+    uint8_t rc;
+    return send_publish(TopicPredefined, topic_id, p_data, length, qos, b_retain, rc);
+}
+
+}
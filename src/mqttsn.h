@@ -0,0 +1,136 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "datagramtransport.h"
+
+namespace Narrowband {
+
+// MQTT-SN v1.2 message types
+enum MqttSnType {
+    MqttSnConnect = 0x04,
+    MqttSnConnack = 0x05,
+    MqttSnRegister = 0x0A,
+    MqttSnRegack = 0x0B,
+    MqttSnPublish = 0x0C,
+    MqttSnPuback = 0x0D,
+    MqttSnPingreq = 0x16,
+    MqttSnPingresp = 0x17,
+    MqttSnDisconnect = 0x18
+};
+
+enum MqttSnReturnCode {
+    MqttSnAccepted = 0x00,
+    MqttSnRejectedCongestion = 0x01,
+    MqttSnRejectedInvalidTopicId = 0x02,
+    MqttSnRejectedNotSupported = 0x03
+};
+
+// MQTT-SN client for publishing through a gateway. Topic names are
+// registered once, later publishes carry the 2 byte topic ID from a
+// fixed size cache. Two character names are sent as short topic names
+// without registering. QoS 0, 1 and -1 (no connection, predefined or
+// short topics only).
+class MqttSnClient {
+public:
+    static const size_t max_topics = 8;
+    static const size_t max_topic_length = 63;
+
+    // wait for an acknowledgement before sending again (T_retry), and
+    // number of tries (N_retry)
+    static const unsigned long retry_timeout = 5000;
+    static const unsigned int max_retries = 3;
+
+    // messages are built in p_tx and received into p_rx
+    MqttSnClient(DatagramTransport& transport, uint8_t *p_tx, size_t sz_tx, uint8_t *p_rx, size_t sz_rx);
+
+    // connects with keep_alive in seconds. The topic cache is cleared
+    // if b_clean_session is set.
+    bool connect(const char *p_client_id, uint16_t keep_alive, bool b_clean_session = true);
+    bool disconnect();
+    bool ping();
+
+    bool isConnected() const { return _b_connected; }
+
+    // looks up topic ID in the cache, registers the topic if not found
+    bool registerTopic(const char *p_topic, uint16_t& topic_id);
+
+    // qos is -1, 0 or 1. With QoS 1 waits for the PUBACK.
+    bool publish(const char *p_topic, const uint8_t *p_data, size_t length, int qos = 0, bool b_retain = false);
+
+    // publishes to a topic ID agreed with the gateway beforehand
+    bool publishPredefined(uint16_t topic_id, const uint8_t *p_data, size_t length, int qos = 0, bool b_retain = false);
+
+    // REGISTER exchanges, i.e. cache misses
+    unsigned long registrations() const { return _registrations; }
+
+    void clearTopics();
+
+protected:
+    struct Topic {
+        char        name[max_topic_length+1];
+        uint16_t    id;
+    };
+
+    enum TopicIdType {
+        TopicNormal = 0x00,
+        TopicPredefined = 0x01,
+        TopicShortName = 0x02
+    };
+
+    Topic *find_topic(const char *p_topic);
+    void add_topic(const char *p_topic, uint16_t id);
+    void remove_topic(uint16_t id);
+
+    bool send_publish(uint8_t id_type, uint16_t topic_id, const uint8_t *p_data, size_t length, int qos, bool b_retain, uint8_t& rc);
+
+    // writes header and returns pointer to variable part, NULL if too large
+    uint8_t *begin_message(uint8_t type, size_t body_length, size_t& length);
+
+    // sends p_tx (length bytes) and waits for a message of type
+    // ack_type with msg_id (if non-zero). Retries as per max_retries.
+    // Returns pointer to the variable part of the acknowledgement.
+    const uint8_t *request(size_t length, uint8_t ack_type, uint16_t msg_id, size_t& ack_length, bool b_set_dup = false);
+
+    // handles messages not waited for, e.g. REGISTER from the gateway
+    void handle_other(uint8_t type, const uint8_t *p, size_t length);
+
+    uint16_t next_msg_id();
+
+    DatagramTransport&  _transport;
+    uint8_t             *_p_tx;
+    size_t              _sz_tx;
+    uint8_t             *_p_rx;
+    size_t              _sz_rx;
+    bool                _b_connected;
+    uint16_t            _msg_id;
+    Topic               _topics[max_topics];
+    size_t              _next_topic;            // slot replaced when the cache is full
+    unsigned long       _registrations;
+
+private:
+    MqttSnClient(const MqttSnClient&);
+    MqttSnClient& operator=(const MqttSnClient&);
+};
+
+}
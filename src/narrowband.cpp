@@ -19,13 +19,75 @@
  */
 
 #include "narrowband.h"
+#include <string.h>
 
 namespace Narrowband {
 
-Narrowband::Narrowband(NarrowbandCore& core) : _core(core) {
-
+Narrowband::Narrowband(NarrowbandCore& core) : _core(core), _p_socket(NULL), _socket_used(0), _socket_idle_timeout(default_socket_idle_timeout), _p_compressor(NULL),
+    _send_error(SendErrorNone), _b_queued(false), _p_coalesce_buf(NULL), _coalesce_len(0), _coalesce_port(0), _coalesce_since(0), _coalesce_latency(default_coalescing_latency),
+    _p_outbox(NULL), _p_drain_buf(NULL), _b_coverage_policy(false), _b_coverage_poor(false), _coverage_checked(0), _deferred_since(0),
+    _attach_started(0), _time_to_attach(0),
+    _radio_next(0), _radio_count(0), _radio_interval(0), _radio_last(0),
+    _echo(-1), _boot_started(0) {
+    memset(&_boot_timings, 0, sizeof(_boot_timings));
+    memset(&_deferral_stats, 0, sizeof(_deferral_stats));
+    _deferral_stats.last_rssi = _deferral_stats.last_ecl = -1;
 } 
 
+Narrowband::~Narrowband() {
+    _core.registrationNotifications().onChange(Callback<void(int)>());
+    delete[] _p_coalesce_buf;
+    delete[] _p_drain_buf;
+    // SocketControl closes on destruction
+    delete _p_socket;
+}
+
+bool Narrowband::boot(unsigned long ready_timeout, Callback<void(bool, unsigned long)> cb) {
+    memset(&_boot_timings, 0, sizeof(_boot_timings));
+    _boot_started = Kernel::get_ms_count();
+
+    // modem may still be starting, probe often at first
+    unsigned long interval = boot_probe_interval;
+    while ( true) {
+        _boot_timings.probes++;
+        if ( _core.ready()) {
+            break;
+        }
+        if ( since_boot() >= ready_timeout) {
+            return false;
+        }
+        wait_ms(interval);
+        interval = (2*interval < boot_probe_max_interval)?2*interval:boot_probe_max_interval;
+    }
+    _boot_timings.ready = since_boot();
+
+    if ( !_core.reportError().set(true)) {
+        return false;
+    }
+    _boot_timings.error_reporting = since_boot();
+
+    if ( !_core.echo().set(false)) {
+        return false;
+    }
+    _echo = 0;
+    _boot_timings.echo_off = since_boot();
+
+    if ( !_core.moduleFunctionality().on()) {
+        return false;
+    }
+    _boot_timings.functionality = since_boot();
+
+    if ( !startAttach(cb)) {
+        return false;
+    }
+    _boot_timings.attach_started = since_boot();
+    return true;
+}
+
+unsigned long Narrowband::since_boot() const {
+    return (unsigned long)(Kernel::get_ms_count()-_boot_started);
+}
+
 void Narrowband::begin() {
     _core.moduleFunctionality().on();
 }
@@ -58,34 +120,141 @@ void Narrowband::currentConfiguration(NarrowbandConfig& c) const {
 }
 
 bool Narrowband::configure(const NarrowbandConfig& c) {
+    ConfigureResult res;
+    return configure(c, res);
+}
+
+bool Narrowband::configure(const NarrowbandConfig& c, ConfigureResult& res) {
+    res = ConfigureResult();
+
     if ( c.echo_on) {
-        _core.echo().set(c.echo_on.get());
+        int echo = c.echo_on.get()?1:0;
+        if ( echo != _echo) {
+            if ( _core.echo().set(echo == 1)) {
+                _echo = echo;
+                res.changed |= ConfigEcho;
+            } else {
+                _echo = -1;
+                res.failed |= ConfigEcho;
+            }
+        }
     }
     if ( c.bands) {
-        list<int> v = c.bands.get();
-        _core.bands().set(v);
+        list<int> wanted = c.bands.get();
+        bool b_supported = true;
+        for ( list<int>::iterator it = wanted.begin(); it != wanted.end(); ++it) {
+            b_supported = b_supported && _core.profile().supportsBand(*it);
+        }
+        if ( !b_supported) {
+            // the module cannot do this, don't bother it
+            res.failed |= ConfigBands;
+        }
+    }
+    if ( c.bands && (res.failed & ConfigBands) == 0) {
+        BandControl bc = _core.bands();
+        list<int> wanted = c.bands.get();
+        list<int> active = bc.activeBands();
+        wanted.sort();
+        active.sort();
+        if ( wanted != active) {
+            if ( bc.set(c.bands.get())) {
+                res.changed |= ConfigBands;
+                // active bands are read at startup
+                res.b_reboot_required = true;
+            } else {
+                res.failed |= ConfigBands;
+            }
+        }
     }
     if ( c.ops_mode) {
         OperatorSelectionControl osc = _core.operatorSelection();
-        if ( c.ops_mode.get() == Manual && c.ops_name) {
-            osc.mode() = Manual;
-            osc.operatorName() = c.ops_name;
-            osc.set();
-        } else if ( c.ops_mode.get() == Automatic || c.ops_mode.get() == Deregister) {
-            osc.mode() = Manual;
-            osc.set();
+        OperatorSelectMode mode = c.ops_mode.get();
+        bool b_known = osc.get();
+
+        bool b_write = false;
+        if ( mode == Manual && c.ops_name) {
+            b_write = !b_known || osc.mode() != Manual || osc.operatorName() != c.ops_name.get();
+            osc.operatorName() = c.ops_name.get();
+        } else if ( mode == Automatic || mode == Deregister) {
+            b_write = !b_known || osc.mode() != mode;
+        }
+
+        if ( b_write) {
+            osc.mode() = mode;
+            if ( osc.set()) {
+                res.changed |= ConfigOperator;
+            } else {
+                res.failed |= ConfigOperator;
+            }
         }
     }
-    return false;
+    return res.failed == 0;
 }
 
 
 bool Narrowband::startAttach() {
     _core.connectionStatus().set(0);                // disable unsolicited result codes
     _core.networkRegistrationStatus().set(0);       // same here
+    _core.registrationNotifications().reset();      // no longer tracked
     return _core.attachment().attach();
 }
 
+bool Narrowband::startAttach(Callback<void(bool, unsigned long)> cb) {
+    RegistrationNotifications& rn = _core.registrationNotifications();
+    rn.onChange(Callback<void(int)>());
+    rn.reset();
+
+    _attach_mtx.lock();
+    _attach_cb = cb;
+    _attach_mtx.unlock();
+    _attach_started = Kernel::get_ms_count();
+    _time_to_attach = 0;
+    rn.onChange(callback(this, &Narrowband::on_registration));
+
+    // +CEREG:<stat>,<tac>,<ci>,<AcT> on every change
+    if ( !_core.networkRegistrationStatus().set(2)) {
+        return false;
+    }
+    if ( !_core.attachment().attach()) {
+        return false;
+    }
+
+    // in case we were registered before URCs were on
+    int status = -1;
+    if ( _core.networkRegistrationStatus().get(status)) {
+        rn.update(status);
+    }
+    return true;
+}
+
+bool Narrowband::waitForAttach(unsigned long timeout) {
+    return _core.registrationNotifications().wait(timeout);
+}
+
+void Narrowband::on_registration(int status) {
+    bool b_registered = RegistrationNotifications::isRegistered(status);
+    if ( !b_registered && status != 3) {
+        return;
+    }
+
+    unsigned long elapsed = (unsigned long)(Kernel::get_ms_count()-_attach_started);
+    if ( b_registered) {
+        _time_to_attach = elapsed;
+        if ( _boot_started != 0 && _boot_timings.attached == 0) {
+            _boot_timings.attached = since_boot();
+        }
+    }
+
+    // report once
+    _attach_mtx.lock();
+    Callback<void(bool, unsigned long)> cb = _attach_cb;
+    _attach_cb = Callback<void(bool, unsigned long)>();
+    _attach_mtx.unlock();
+    if ( cb) {
+        cb(b_registered, elapsed);
+    }
+}
+
 bool Narrowband::startDetach() {
     return _core.attachment().detach();
 }
@@ -94,14 +263,373 @@ bool Narrowband::isAttached() const {
     return _core.attachment().isAttached();
 }
 
-bool Narrowband::sendUDP(string remoteAddr, unsigned int port, string body) {
-    bool res = false;
-    UDPSocketControl sc = _core.udp();
-    if (sc.open()) {
-        res = sc.sendTo(remoteAddr.c_str(), port, body.length(), (const uint8_t*)body.c_str());
-        sc.close();
+bool Narrowband::sendUDP(string remoteAddr, unsigned int port, string body, int options) {
+    // urgent datagrams go ahead of other threads' commands
+    CommandPriority prev = PriorityNormal;
+    if ( options & SendUrgent) {
+        prev = _core.adapter().setCommandPriority(PriorityUrgent);
+    }
+
+    // transmit() tells modem failures
+    _send_error = SendErrorNone;
+    _b_queued = false;
+    bool res;
+    if ( _p_coalesce_buf != NULL) {
+        res = coalesce(remoteAddr, port, (const uint8_t*)body.data(), body.length(), options);
+    } else {
+        res = dispatch(remoteAddr, port, (const uint8_t*)body.data(), body.length(), options);
+    }
+    if ( !res && _send_error == SendErrorNone) {
+        _send_error = SendErrorRejected;
+    }
+
+    if ( options & SendUrgent) {
+        _core.adapter().setCommandPriority(prev);
+    }
+    return res;
+}
+
+size_t Narrowband::maxMessage() const {
+    // coalescing prefixes each message with its length
+    return max_message()-((_p_coalesce_buf != NULL)?2:0);
+}
+
+void Narrowband::setCoalescing(bool b_enable, unsigned long max_latency) {
+    _coalesce_latency = max_latency;
+    if ( b_enable && _p_coalesce_buf == NULL) {
+        _p_coalesce_buf = new uint8_t[UDPSocketControl::max_payload];
+        _coalesce_len = 0;
+    }
+    if ( !b_enable && _p_coalesce_buf != NULL) {
+        flush();
+        delete[] _p_coalesce_buf;
+        _p_coalesce_buf = NULL;
+    }
+}
+
+bool Narrowband::flush() {
+    if ( _p_coalesce_buf == NULL || _coalesce_len == 0) {
+        return true;
     }
+    bool res = dispatch(_coalesce_addr, _coalesce_port, _p_coalesce_buf, _coalesce_len, SendDefault);
+    _coalesce_len = 0;
     return res;
 }
 
+bool Narrowband::coalesce(const string& remoteAddr, unsigned int port, const uint8_t *p_data, size_t length, int options) {
+    // leave room for the header byte of compression
+    size_t capacity = max_message();
+    if ( 2+length > capacity) {
+        return false;
+    }
+
+    if ( _coalesce_len > 0 && (_coalesce_port != port || _coalesce_addr != remoteAddr || _coalesce_len+2+length > capacity)) {
+        if ( !flush()) {
+            return false;
+        }
+    }
+
+    if ( _coalesce_len == 0) {
+        _coalesce_addr = remoteAddr;
+        _coalesce_port = port;
+        _coalesce_since = Kernel::get_ms_count();
+    }
+    _p_coalesce_buf[_coalesce_len++] = (uint8_t)(length >> 8);
+    _p_coalesce_buf[_coalesce_len++] = (uint8_t)length;
+    memcpy(_p_coalesce_buf+_coalesce_len, p_data, length);
+    _coalesce_len += length;
+
+    if ( options & (SendFlush | SendUrgent | SendReleaseAfterUplink | SendReleaseAfterFirstDownlink)) {
+        bool res = dispatch(_coalesce_addr, _coalesce_port, _p_coalesce_buf, _coalesce_len, options);
+        _coalesce_len = 0;
+        return res;
+    }
+    return true;
+}
+
+bool Narrowband::dispatch(const string& remoteAddr, unsigned int port, const uint8_t *p_data, size_t length, int options) {
+    if ( length > max_message()) {
+        return false;
+    }
+    if ( _p_outbox == NULL) {
+        return deliver(remoteAddr, port, p_data, length, options);
+    }
+    if ( known_detached()) {
+        // no point waiting out the send timeouts, poll() sends it later
+        return enqueue(remoteAddr, port, p_data, length, options);
+    }
+    if ( _b_coverage_policy && !(options & SendUrgent)) {
+        if ( !_p_outbox->empty() || coverage_is_poor()) {
+            if ( !enqueue(remoteAddr, port, p_data, length, options)) {
+                return false;
+            }
+            if ( _b_coverage_poor) {
+                _deferral_stats.deferred++;
+                if ( _deferred_since == 0) {
+                    _deferred_since = Kernel::get_ms_count();
+                }
+            }
+            return true;
+        }
+        return deliver(remoteAddr, port, p_data, length, options) ||
+            enqueue(remoteAddr, port, p_data, length, options);
+    }
+    if ( options & SendUrgent) {
+        // may overtake queued datagrams
+        return deliver(remoteAddr, port, p_data, length, options) ||
+            enqueue(remoteAddr, port, p_data, length, options);
+    }
+
+    // queued messages go first, poll() sends them in order
+    if ( _p_outbox->empty() && deliver(remoteAddr, port, p_data, length, options)) {
+        return true;
+    }
+    return enqueue(remoteAddr, port, p_data, length, options);
+}
+
+void Narrowband::setOutbox(Outbox *p_outbox) {
+    // drainOutbox() peeks into this, too large for a thread's stack
+    if ( p_outbox != NULL && _p_drain_buf == NULL) {
+        _p_drain_buf = new uint8_t[UDPSocketControl::max_payload];
+    }
+    _p_outbox = p_outbox;
+}
+
+bool Narrowband::known_detached() {
+    int status = _core.registrationNotifications().status();
+    return status >= 0 && status != 4 && !RegistrationNotifications::isRegistered(status);
+}
+
+bool Narrowband::enqueue(const string& remoteAddr, unsigned int port, const uint8_t *p_data, size_t length, int options) {
+    if ( !_p_outbox->push(remoteAddr, port, p_data, length, options)) {
+        return false;
+    }
+    _b_queued = true;
+    return true;
+}
+
+bool Narrowband::drainOutbox() {
+    if ( _p_outbox == NULL || _p_outbox->empty()) {
+        _deferred_since = 0;
+        return true;
+    }
+
+    bool b_forced = false;
+    if ( _b_coverage_policy && coverage_is_poor()) {
+        uint64_t now = Kernel::get_ms_count();
+        if ( _deferred_since == 0) {
+            _deferred_since = now;
+        }
+        unsigned long held = (unsigned long)(now-_deferred_since);
+        if ( held > _deferral_stats.longest_deferral) {
+            _deferral_stats.longest_deferral = held;
+        }
+        if ( held < _coverage_policy.max_deferral) {
+            return false;
+        }
+        b_forced = true;
+    }
+
+    if ( known_detached()) {
+        return false;
+    }
+
+    string addr;
+    unsigned int port;
+    size_t length;
+    int options;
+    while ( !_p_outbox->empty()) {
+        if ( !_p_outbox->peek(addr, port, _p_drain_buf, UDPSocketControl::max_payload, length, options)) {
+            return false;
+        }
+        if ( !deliver(addr, port, _p_drain_buf, length, options)) {
+            return false;
+        }
+        _p_outbox->pop();
+        if ( _b_coverage_policy) {
+            if ( b_forced) {
+                _deferral_stats.forced++;
+            } else {
+                _deferral_stats.flushed++;
+            }
+        }
+    }
+    _deferred_since = 0;
+    return true;
+}
+
+bool Narrowband::setCoveragePolicy(const CoveragePolicy& policy) {
+    if ( _p_outbox == NULL) {
+        return false;
+    }
+    _coverage_policy = policy;
+    _b_coverage_policy = true;
+    _coverage_checked = 0;
+    return true;
+}
+
+bool Narrowband::coverage_is_poor() {
+    uint64_t now = Kernel::get_ms_count();
+    if ( _coverage_checked != 0 && now-_coverage_checked < _coverage_policy.check_interval) {
+        return _b_coverage_poor;
+    }
+    _coverage_checked = now;
+    _deferral_stats.checks++;
+
+    int rssi = _core.signalQuality().getRSSI();
+    _deferral_stats.last_rssi = rssi;
+    bool b_poor = (rssi < _coverage_policy.min_rssi || rssi == 99);
+
+    if ( !b_poor && _coverage_policy.max_ecl >= 0 && _core.supports(ModuleRadioStats)) {
+        NUEStatsRadio radio;
+        radio.ecl = -1;
+        if ( _core.nueStats().getRadio(radio)) {
+            _deferral_stats.last_ecl = radio.ecl;
+            b_poor = (radio.ecl > _coverage_policy.max_ecl);
+        }
+    }
+
+    if ( b_poor) {
+        _deferral_stats.poor++;
+    }
+    _b_coverage_poor = b_poor;
+    return b_poor;
+}
+
+bool Narrowband::deliver(const string& remoteAddr, unsigned int port, const uint8_t *p_data, size_t length, int options) {
+    if ( _p_compressor != NULL) {
+        if ( !_p_compressor->compress(p_data, length)) {
+            return false;
+        }
+        p_data = _p_compressor->data();
+        length = _p_compressor->size();
+    }
+
+    int flags = UDPSendFlagNone;
+    if ( options & SendReleaseAfterUplink) {
+        flags |= UDPSendFlagReleaseAfterUplink;
+    }
+    if ( options & SendReleaseAfterFirstDownlink) {
+        flags |= UDPSendFlagReleaseAfterFirstDownlink;
+    }
+
+    return transmit(remoteAddr, port, p_data, length, flags);
+}
+
+bool Narrowband::transmit(const string& remoteAddr, unsigned int port, const uint8_t *p_data, size_t length, int flags) {
+    if ( length > max_datagram()) {
+        return false;
+    }
+    if ( !_core.supports(ModuleReleaseAssistance)) {
+        // RAI is a hint, send without it rather than fail
+        flags = UDPSendFlagNone;
+    }
+    closeIdleSocket();
+
+    // try the cached socket first. If that fails the socket may be gone
+    // (modem rebooted, socket closed by modem), so reopen once and retry.
+    for ( int attempt = 0; attempt < 2; attempt++) {
+        UDPSocketControl *sc = acquireSocket();
+        if ( sc == NULL) {
+            _send_error = SendErrorModem;
+            return false;
+        }
+        if ( sc->sendTo(remoteAddr.c_str(), port, length, p_data, flags)) {
+            _socket_used = Kernel::get_ms_count();
+            if ( _boot_started != 0 && _boot_timings.first_packet == 0) {
+                _boot_timings.first_packet = since_boot();
+            }
+            return true;
+        }
+        if ( !sc->close()) {
+            sc->invalidate();
+        }
+    }
+    _send_error = SendErrorModem;
+    return false;
+}
+
+void Narrowband::poll() {
+    if ( _p_coalesce_buf != NULL && _coalesce_len > 0 && Kernel::get_ms_count()-_coalesce_since >= _coalesce_latency) {
+        flush();
+    }
+    drainOutbox();
+    closeIdleSocket();
+    if ( _radio_interval > 0 && Kernel::get_ms_count()-_radio_last >= _radio_interval) {
+        sampleRadio();
+    }
+}
+
+bool Narrowband::sampleRadio() {
+    _radio_last = Kernel::get_ms_count();
+    if ( !_core.supports(ModuleRadioStats)) {
+        return false;
+    }
+
+    RadioSample rs;
+    memset(&rs, 0, sizeof(rs));
+    rs.timestamp = _radio_last;
+    if ( !_core.nueStats().getRadio(rs.radio)) {
+        return false;
+    }
+    _radio_samples[_radio_next] = rs;
+    _radio_next = (_radio_next+1) % radio_sample_count;
+    if ( _radio_count < radio_sample_count) {
+        _radio_count++;
+    }
+    return true;
+}
+
+bool Narrowband::radioSample(size_t i, RadioSample& sample) const {
+    if ( i >= _radio_count) {
+        return false;
+    }
+    sample = _radio_samples[(_radio_next+radio_sample_count-1-i) % radio_sample_count];
+    return true;
+}
+
+void Narrowband::closeSockets() {
+    if ( _p_socket != NULL && _p_socket->isOpen()) {
+        if ( !_p_socket->close()) {
+            _p_socket->invalidate();
+        }
+    }
 }
+
+void Narrowband::resetSockets() {
+    if ( _p_socket != NULL) {
+        _p_socket->invalidate();
+    }
+}
+
+UDPSocketControl* Narrowband::acquireSocket() {
+    if ( _p_socket == NULL) {
+        _p_socket = new UDPSocketControl(_core.udp());
+    }
+    if ( _p_socket->isOpen()) {
+        return _p_socket;
+    }
+    if ( _p_socket->open()) {
+        _socket_used = Kernel::get_ms_count();
+        return _p_socket;
+    }
+    return NULL;
+}
+
+void Narrowband::closeIdleSocket() {
+    if ( _p_socket != NULL && _p_socket->isOpen() && Kernel::get_ms_count()-_socket_used >= _socket_idle_timeout) {
+        closeSockets();
+    }
+}
+
+size_t Narrowband::max_message() const {
+    // leave room for the header byte of compression
+    return max_datagram()-((_p_compressor != NULL)?1:0);
+}
+
+size_t Narrowband::max_datagram() const {
+    size_t n = _core.profile().max_payload;
+    return (n < UDPSocketControl::max_payload)?n:UDPSocketControl::max_payload;
+}
+
+}
\ No newline at end of file
@@ -21,6 +21,8 @@
 #pragma once
 
 #include "narrowbandcore.h"
+#include "compression.h"
+#include "outbox.h"
 #include <string>
 
 namespace Narrowband {
@@ -45,6 +47,56 @@ private:
     bool    _cfg;
 };
 
+// per-send options of Narrowband::sendUDP, may be combined
+enum SendOption {
+    SendDefault = 0,
+    SendReleaseAfterUplink = 1,             // RAI, drop to idle right after this datagram
+    SendReleaseAfterFirstDownlink = 2,      // RAI, drop to idle after the reply to this datagram
+    SendFlush = 4,                          // when coalescing, send the datagram right after this message
+    SendUrgent = 8                          // send now, regardless of the coverage policy (implies SendFlush)
+};
+
+// why the latest Narrowband::sendUDP failed
+enum SendError {
+    SendErrorNone = 0,
+    SendErrorRejected,                      // not sent, e.g. too large or outbox full
+    SendErrorModem                          // modem did not take it: timeout, ERROR, not attached
+};
+
+// when Narrowband defers uplinks, see setCoveragePolicy()
+struct CoveragePolicy {
+    int             min_rssi;               // AT+CSQ RSSI below this, or 99 (unknown), is poor coverage
+    int             max_ecl;                // coverage enhancement level above this is poor, -1 to ignore ECL
+    unsigned long   check_interval;         // msecs a coverage reading is reused
+    unsigned long   max_deferral;           // msecs after which deferred datagrams are sent anyway
+
+    CoveragePolicy() : min_rssi(5), max_ecl(1), check_interval(30000), max_deferral(600000) { }
+};
+
+struct DeferralStats {
+    unsigned long   deferred;               // datagrams deferred because of poor coverage
+    unsigned long   flushed;                // queued datagrams sent in good coverage
+    unsigned long   forced;                 // queued datagrams sent after max_deferral
+    unsigned long   checks;                 // coverage readings taken
+    unsigned long   poor;                   // readings that found poor coverage
+    unsigned long   longest_deferral;       // msecs, longest time the outbox was held back
+    int             last_rssi;              // last reading, -1 if none
+    int             last_ecl;
+};
+
+// msecs after Narrowband::boot() was called at which each phase
+// was done, 0 if not (yet) reached
+struct BootTimings {
+    unsigned long   ready;                  // modem answered AT
+    unsigned long   error_reporting;        // AT+CMEE=1
+    unsigned long   echo_off;               // echo off
+    unsigned long   functionality;          // AT+CFUN=1
+    unsigned long   attach_started;         // AT+CGATT=1
+    unsigned long   attached;               // +CEREG registered
+    unsigned long   first_packet;           // first datagram sent
+    unsigned int    probes;                 // AT probes until ready
+};
+
 struct NarrowbandConfig {
     config_item<bool>          echo_on;
     config_item<list<int> >    bands;
@@ -52,9 +104,61 @@ struct NarrowbandConfig {
     config_item<string>                 ops_name;
 };
 
+// radio statistics taken by Narrowband
+struct RadioSample {
+    uint64_t        timestamp;              // ms, Kernel::get_ms_count()
+    NUEStatsRadio   radio;
+};
+
+// items of NarrowbandConfig, as bit mask in ConfigureResult
+enum ConfigItem {
+    ConfigEcho = 0x01,
+    ConfigBands = 0x02,
+    ConfigOperator = 0x04
+};
+
+// outcome of Narrowband::configure
+struct ConfigureResult {
+    int     changed;                        // ConfigItem bits written to the modem
+    int     failed;                         // ConfigItem bits that could not be written
+    bool    b_reboot_required;              // a change takes effect after reboot
+
+    ConfigureResult() : changed(0), failed(0), b_reboot_required(false) { }
+};
+
 class Narrowband {
 public:
+    // the UDP socket is kept open across sends, one reaches every
+    // destination. Unused for this long it is closed by poll().
+    static const unsigned long default_socket_idle_timeout = 60000;
+
+    // coalesced messages wait at most this long
+    static const unsigned long default_coalescing_latency = 5000;
+
+    // readiness probes during boot() start this many msecs apart,
+    // doubling up to boot_probe_max_interval
+    static const unsigned long boot_probe_interval = 10;
+    static const unsigned long boot_probe_max_interval = 320;
+    static const unsigned long default_boot_ready_timeout = 10000;
+
+    // number of radio samples kept
+    static const size_t radio_sample_count = 16;
+
     Narrowband(NarrowbandCore&);
+    ~Narrowband();
+
+    // brings the modem up to attaching: waits up to ready_timeout msecs
+    // for the modem to answer, then turns on error reporting, turns echo
+    // off, enables the module and starts to attach as startAttach(cb)
+    // does, without pauses in between. Phases are recorded in bootTimings().
+    bool boot(unsigned long ready_timeout = default_boot_ready_timeout,
+              Callback<void(bool, unsigned long)> cb = Callback<void(bool, unsigned long)>());
+
+    // time-to-first-packet breakdown of the last boot()
+    const BootTimings& bootTimings() const { return _boot_timings; }
+
+    // the modem this instance drives
+    NarrowbandCore& core() { return _core; }
 
     // enable modem
     void begin();
@@ -68,21 +172,200 @@ public:
     // retrieve the current configuration
     void currentConfiguration(NarrowbandConfig& ) const;
 
-    // set/update configuration
+    // set/update configuration. Enabled items are compared to the
+    // modem's current settings and only written if they differ. Echo
+    // cannot be read, so it is compared to the last value written.
+    // Returns true if all changes were written.
     bool configure(const NarrowbandConfig&);
+    bool configure(const NarrowbandConfig&, ConfigureResult& result);
 
     // trigger network attachment
     bool startAttach();
     bool startDetach();
 
+    // trigger network attachment and complete on +CEREG URCs instead of
+    // polling. cb (optional) is called once registration is done, with
+    // the result and msecs since the attach started. It runs on the
+    // CommandAdapter's thread and must not send commands.
+    bool startAttach(Callback<void(bool, unsigned long)> cb);
+
+    // waits up to timeout msecs for an attach started above
+    bool waitForAttach(unsigned long timeout);
+
+    // msecs the last attach took, 0 if not (yet) attached
+    unsigned long timeToAttach() const { return _time_to_attach; }
+
     // check if attached to network
     bool isAttached() const;
 
-    // one-way send to remote ip/port as UDP datagram
-    bool sendUDP(string remoteAddr, unsigned int port, string body);
+    // one-way send to remote ip/port as UDP datagram. options
+    // is a combination of SendOption values. When coalescing or with
+    // an outbox, returns true once the message has been accepted.
+    // Commands for SendUrgent datagrams go ahead of other threads'
+    // commands waiting for the adapter.
+    bool sendUDP(string remoteAddr, unsigned int port, string body, int options = SendDefault);
+
+    // why the latest sendUDP returned false
+    SendError sendError() const { return _send_error; }
+
+    // true if the latest sendUDP put its datagram into the outbox
+    // instead of sending it (detached, failed, deferred)
+    bool queued() const { return _b_queued; }
+
+    // largest body sendUDP takes, as per module profile, compression
+    // and coalescing
+    size_t maxMessage() const;
+
+    // collect messages to the same destination into one datagram. Each
+    // message is prefixed by its length (2 bytes, big endian). The datagram
+    // is sent when the next message does not fit or goes elsewhere, when
+    // its first message is max_latency msecs old (see poll()), on flush()
+    // or with SendFlush/RAI options. Off by default.
+    void setCoalescing(bool b_enable, unsigned long max_latency = default_coalescing_latency);
+
+    // sends pending coalesced messages. Messages are dropped if sending fails.
+    bool flush();
+
+    // compress payloads of sendUDP with p_compressor, NULL turns
+    // compression off. The receiver has to decompress (see compression.h).
+    void setCompressor(Compressor *p_compressor) { _p_compressor = p_compressor; }
+
+    // queue datagrams that cannot be sent (e.g. not attached) in
+    // p_outbox instead of failing. Once queued, later datagrams are
+    // queued behind them to keep the order. While +CEREG URCs (see
+    // startAttach(cb)) report the modem not registered, datagrams are
+    // queued without trying. NULL turns queueing off.
+    void setOutbox(Outbox *p_outbox);
+
+    // sends queued datagrams in order unless known to be detached. Stops at the first
+    // failure, returns true if the outbox is empty.
+    bool drainOutbox();
+
+    // defer datagrams without SendUrgent into the outbox (see setOutbox)
+    // while coverage is poor according to policy. poll() sends them once
+    // coverage is good again, or when they have waited max_deferral msecs.
+    // Deferring needs the outbox: returns false without one, and the
+    // policy does nothing while setOutbox(NULL). ECL is only read on
+    // modules with AT+NUESTATS.
+    bool setCoveragePolicy(const CoveragePolicy& policy);
+    void clearCoveragePolicy() { _b_coverage_policy = false; }
+
+    const DeferralStats& deferralStats() const { return _deferral_stats; }
+
+    // periodic housekeeping, closes the idle socket, sends
+    // coalesced messages that are due, drains the outbox and takes
+    // radio samples.
+    void poll();
+
+    // take a radio sample (AT+NUESTATS=RADIO) every interval msecs
+    // in poll(), 0 turns sampling off. The last radio_sample_count
+    // samples are kept.
+    void setRadioSampling(unsigned long interval) { _radio_interval = interval; }
+
+    // takes a radio sample now, e.g. after a slow uplink
+    bool sampleRadio();
+
+    size_t radioSampleCount() const { return _radio_count; }
+
+    // i = 0 is the latest sample
+    bool radioSample(size_t i, RadioSample& sample) const;
+
+    // get/set msecs after which the unused socket is closed
+    unsigned long& socketIdleTimeout() { return _socket_idle_timeout; }
+
+    // closes the cached socket
+    void closeSockets();
+
+    // forgets the cached socket without closing it, call after
+    // the modem has been rebooted.
+    void resetSockets();
 
 protected:
+    // +CEREG status change during startAttach(cb)
+    void on_registration(int status);
+
+    // msecs since boot() started
+    unsigned long since_boot() const;
+
+    // reads coverage as per policy, at most every check_interval msecs
+    bool coverage_is_poor();
+
+    // true if +CEREG URCs report the modem not registered. Without
+    // URCs (status unknown) sends are tried and queued if they fail.
+    bool known_detached();
+
+    // largest datagram the module takes
+    size_t max_datagram() const;
+
+    // largest message sendUDP takes, max_datagram() less the
+    // compression header
+    size_t max_message() const;
+
+    // queues a datagram in the outbox, see queued()
+    bool enqueue(const string& remoteAddr, unsigned int port, const uint8_t *p_data, size_t length, int options);
+
+    // sends a datagram or queues it in the outbox
+    bool dispatch(const string& remoteAddr, unsigned int port, const uint8_t *p_data, size_t length, int options);
+
+    // compresses (if enabled) and transmits a datagram
+    bool deliver(const string& remoteAddr, unsigned int port, const uint8_t *p_data, size_t length, int options);
+
+    // adds a message to the coalesced datagram
+    bool coalesce(const string& remoteAddr, unsigned int port, const uint8_t *p_data, size_t length, int options);
+
+    // sends datagram through the cached socket
+    bool transmit(const string& remoteAddr, unsigned int port, const uint8_t *p_data, size_t length, int flags);
+
+    // returns the open cached socket, opens it if necessary.
+    UDPSocketControl* acquireSocket();
+    void closeIdleSocket();
+
     NarrowbandCore&    _core;
+
+    UDPSocketControl    *_p_socket;                     // NULL until first send
+    uint64_t            _socket_used;                   // ms, Kernel::get_ms_count()
+    unsigned long       _socket_idle_timeout;
+
+    Compressor          *_p_compressor;
+    SendError           _send_error;
+    bool                _b_queued;
+
+    uint8_t             *_p_coalesce_buf;               // UDPSocketControl::max_payload bytes, NULL if off
+    size_t              _coalesce_len;
+    string              _coalesce_addr;
+    unsigned int        _coalesce_port;
+    uint64_t            _coalesce_since;                // ms, first message added
+    unsigned long       _coalesce_latency;
+
+    Outbox              *_p_outbox;
+    uint8_t             *_p_drain_buf;                  // UDPSocketControl::max_payload bytes, NULL until an outbox is set
+
+    bool                _b_coverage_policy;
+    CoveragePolicy      _coverage_policy;
+    bool                _b_coverage_poor;
+    uint64_t            _coverage_checked;              // ms, 0 if never
+    uint64_t            _deferred_since;                // ms, 0 if outbox not held back
+    DeferralStats       _deferral_stats;
+
+    Callback<void(bool, unsigned long)> _attach_cb;
+    Mutex               _attach_mtx;                    // guards _attach_cb
+    uint64_t            _attach_started;                // ms
+    volatile unsigned long _time_to_attach;
+
+    RadioSample         _radio_samples[radio_sample_count];
+    size_t              _radio_next;                    // slot for next sample
+    size_t              _radio_count;
+    unsigned long       _radio_interval;
+    uint64_t            _radio_last;                    // ms, last sample
+
+    int                 _echo;                          // last echo setting written, -1 if unknown
+
+    uint64_t            _boot_started;                  // ms, 0 if not booted
+    BootTimings         _boot_timings;
+
+private:
+    Narrowband(const Narrowband&);
+    Narrowband& operator=(const Narrowband&);
 };
 
 }
\ No newline at end of file
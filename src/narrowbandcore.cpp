@@ -22,8 +22,15 @@
 
 namespace Narrowband {
 
-NarrowbandCore::NarrowbandCore(CommandAdapterBase& ca) : _ca(ca) {
+NarrowbandCore::NarrowbandCore(CommandAdapterBase& ca, const ModuleProfile& profile) :
+    _ca(ca), _profile(profile), _status_concat(profile.supports(ModuleCommandChaining)?-1:0) {
+    _ca.addURCHandler(callback(&_socket_notifications, &SocketNotifications::on_urc));
+    _ca.addURCHandler(callback(&_registration_notifications, &RegistrationNotifications::on_urc));
+}
 
+NarrowbandCore::~NarrowbandCore() {
+    _ca.removeURCHandler(callback(&_socket_notifications, &SocketNotifications::on_urc));
+    _ca.removeURCHandler(callback(&_registration_notifications, &RegistrationNotifications::on_urc));
 }
 
 bool NarrowbandCore::ready() {
@@ -98,6 +105,10 @@ NConfigControl NarrowbandCore::nconfig() const {
     return NConfigControl(_ca);
 }
 
+NUEStatsControl NarrowbandCore::nueStats() const {
+    return NUEStatsControl(_ca);
+}
+
 ConnectionStatusControl NarrowbandCore::connectionStatus() const {
     return ConnectionStatusControl(_ca);
 }
@@ -111,8 +122,95 @@ AttachmentControl NarrowbandCore::attachment() const {
 }
 
 UDPSocketControl NarrowbandCore::udp() const {
-    return UDPSocketControl(_ca);
+    return UDPSocketControl(_ca, &_socket_notifications);
 }
 
 
+// commands read by status(), in order
+static const char * const status_commands[] = { "AT+CSQ", "AT+CEREG?", "AT+CSCON?", "AT+CGATT?", "AT+CGACT?", NULL };
+
+// returns field idx of a comma separated value, -1 if missing
+static int status_field(const string& v, int idx) {
+    size_t p = 0;
+    for ( int i = 0; i < idx; i++) {
+        p = v.find(',', p);
+        if ( p == string::npos) {
+            return -1;
+        }
+        p++;
+    }
+    if ( p >= v.length()) {
+        return -1;
+    }
+    return atoi(v.c_str()+p);
+}
+
+// takes all status values found in r
+static void parse_status(ModemResponse& r, ModemStatus& s) {
+    multimap<string,string>& m = r.getCommandResponses();
+    for ( multimap<string,string>::iterator it = m.begin(); it != m.end(); ++it) {
+        const string& v = it->second;
+        if ( it->first == "+CSQ") {
+            s.rssi = status_field(v, 0);
+            s.ber = status_field(v, 1);
+        } else if ( it->first == "+CEREG") {
+            s.registration = status_field(v, 1);
+        } else if ( it->first == "+CSCON") {
+            s.connection = status_field(v, 1);
+        } else if ( it->first == "+CGATT") {
+            s.attached = status_field(v, 0);
+        } else if ( it->first == "+CGACT") {
+            // one line per context, <cid>,<state>
+            if ( status_field(v, 1) == 1) {
+                s.pdp_active++;
+            }
+        }
+    }
 }
+
+bool NarrowbandCore::status(ModemStatus& s) {
+    s.timestamp = Kernel::get_ms_count();
+    s.rssi = s.ber = s.registration = s.connection = s.attached = s.pdp_active = -1;
+    s.round_trips = 0;
+
+    if ( _status_concat != 0) {
+        string cmd = status_commands[0];
+        for ( const char * const *p = status_commands+1; *p != NULL; p++) {
+            cmd += ';';
+            cmd += (*p)+2;                  // without "AT"
+        }
+
+        ModemResponse r;
+        s.round_trips++;
+        bool b_sent = _ca.send(cmd.c_str(), r, 1000);
+        if ( b_sent && r.isOk()) {
+            _status_concat = 1;
+            s.pdp_active = 0;
+            parse_status(r, s);
+            return true;
+        }
+        if ( !b_sent || _status_concat == 1) {
+            return false;
+        }
+        // modem rejects the line, don't try again
+        _status_concat = 0;
+    }
+
+    bool res = true;
+    for ( const char * const *p = status_commands; *p != NULL; p++) {
+        ModemResponse r;
+        s.round_trips++;
+        if ( _ca.send(*p, r, 500) && r.isOk()) {
+            if ( strcmp(*p, "AT+CGACT?") == 0) {
+                // no lines if there are no contexts
+                s.pdp_active = 0;
+            }
+            parse_status(r, s);
+        } else {
+            res = false;
+        }
+    }
+    return res;
+}
+
+}
\ No newline at end of file
@@ -22,13 +22,35 @@
 
 #include "commandadapter.h"
 #include "controls.h"
+#include "moduleprofile.h"
 #include <string>
 
 namespace Narrowband {
 
+// modem state collected by NarrowbandCore::status(). Values that
+// could not be read are -1.
+struct ModemStatus {
+    uint64_t        timestamp;              // ms, Kernel::get_ms_count() when taken
+    int             rssi;                   // AT+CSQ, 99 = not known
+    int             ber;                    // AT+CSQ, 99 = not known
+    int             registration;           // AT+CEREG? <stat>
+    int             connection;             // AT+CSCON? <mode>, 1 = connected, 0 = idle
+    int             attached;               // AT+CGATT?, 1 = attached
+    int             pdp_active;             // AT+CGACT?, number of active contexts
+    unsigned int    round_trips;            // commands sent to collect this
+};
+
 class NarrowbandCore {
 public:
-    NarrowbandCore(CommandAdapterBase&);
+    NarrowbandCore(CommandAdapterBase&, const ModuleProfile& profile = module_profile<GenericProfile>());
+    ~NarrowbandCore();
+
+    // the adapter commands are sent through
+    CommandAdapterBase& adapter() { return _ca; }
+
+    // capabilities and limits of the module
+    const ModuleProfile& profile() const { return _profile; }
+    bool supports(unsigned int cmd) const { return _profile.supports(cmd); }
 
     // checks if modem is ready
     bool ready();    
@@ -36,7 +58,7 @@ public:
     // reboots module
     void reboot();
 
-    // turns echo on or off
+    // turns echo on or off, echo cannot be read
     OnOffControl echo();
 
     // turns UE error reporting on or off 
@@ -74,6 +96,9 @@ public:
     // get/set configuration
     NConfigControl nconfig() const;
 
+    // radio statistics (AT+NUESTATS)
+    NUEStatsControl nueStats() const;
+
     ConnectionStatusControl connectionStatus() const;
 
     NetworkRegistrationStatusControl networkRegistrationStatus() const;
@@ -82,9 +107,34 @@ public:
 
     UDPSocketControl udp() const;
 
+    // reads signal quality, registration, connection, attachment and
+    // PDP context state at once, one query per command. Commands are
+    // concatenated into one line if the modem accepts that.
+    bool status(ModemStatus& s);
+
+    // +CEREG state, updated by URCs if enabled (AT+CEREG=1 or 2)
+    RegistrationNotifications& registrationNotifications() { return _registration_notifications; }
+
 protected:
     CommandAdapterBase&    _ca;
+    const ModuleProfile&   _profile;
 
+    // +NSONMI state shared by all UDP sockets of this modem
+    mutable SocketNotifications _socket_notifications;
+
+    RegistrationNotifications   _registration_notifications;
+
+    // whether status() may concatenate commands, -1 if not known yet
+    int                         _status_concat;
+
+};
+
+// NarrowbandCore for a module known at compile time, e.g.
+// NarrowbandCoreFor<BC95Profile> nbc(mca);
+template <class P>
+class NarrowbandCoreFor : public NarrowbandCore {
+public:
+    NarrowbandCoreFor(CommandAdapterBase& ca) : NarrowbandCore(ca, module_profile<P>()) { }
 };
 
 }
\ No newline at end of file
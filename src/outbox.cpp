@@ -0,0 +1,236 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#include "outbox.h"
+#include <string.h>
+
+namespace Narrowband {
+
+RAMOutboxStore::RAMOutboxStore(uint8_t *p_buf, size_t sz_buf) : _p_buf(p_buf), _sz_buf(sz_buf), _b_valid(false) {
+}
+
+bool RAMOutboxStore::read(size_t offset, uint8_t *p_data, size_t length) {
+    memcpy(p_data, _p_buf+offset, length);
+    return true;
+}
+
+bool RAMOutboxStore::write(size_t offset, const uint8_t *p_data, size_t length) {
+    memcpy(_p_buf+offset, p_data, length);
+    return true;
+}
+
+bool RAMOutboxStore::loadState(OutboxState& state) {
+    state = _state;
+    return _b_valid;
+}
+
+bool RAMOutboxStore::saveState(const OutboxState& state) {
+    _state = state;
+    _b_valid = true;
+    return true;
+}
+
+static const uint8_t file_magic[4] = { 'N', 'B', 'O', 'X' };
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+FileOutboxStore::FileOutboxStore(const char *p_path, size_t capacity) : _capacity(capacity) {
+    _fp = fopen(p_path, "r+b");
+    if ( _fp == NULL) {
+        _fp = fopen(p_path, "w+b");
+    }
+}
+
+FileOutboxStore::~FileOutboxStore() {
+    if ( _fp != NULL) {
+        fclose(_fp);
+    }
+}
+
+bool FileOutboxStore::read(size_t offset, uint8_t *p_data, size_t length) {
+    if ( _fp == NULL || fseek(_fp, (long)(header_size+offset), SEEK_SET) != 0) {
+        return false;
+    }
+    return fread(p_data, 1, length, _fp) == length;
+}
+
+bool FileOutboxStore::write(size_t offset, const uint8_t *p_data, size_t length) {
+    if ( _fp == NULL || fseek(_fp, (long)(header_size+offset), SEEK_SET) != 0) {
+        return false;
+    }
+    return fwrite(p_data, 1, length, _fp) == length && fflush(_fp) == 0;
+}
+
+bool FileOutboxStore::loadState(OutboxState& state) {
+    uint8_t buf[header_size];
+    if ( _fp == NULL || fseek(_fp, 0, SEEK_SET) != 0 || fread(buf, 1, sizeof(buf), _fp) != sizeof(buf)) {
+        return false;
+    }
+    if ( memcmp(buf, file_magic, sizeof(file_magic)) != 0) {
+        return false;
+    }
+    state.head = get_u32(buf+4);
+    state.used = get_u32(buf+8);
+    state.count = get_u32(buf+12);
+    return true;
+}
+
+bool FileOutboxStore::saveState(const OutboxState& state) {
+    uint8_t buf[header_size];
+    memcpy(buf, file_magic, sizeof(file_magic));
+    put_u32(buf+4, state.head);
+    put_u32(buf+8, state.used);
+    put_u32(buf+12, state.count);
+
+    if ( _fp == NULL || fseek(_fp, 0, SEEK_SET) != 0) {
+        return false;
+    }
+    return fwrite(buf, 1, sizeof(buf), _fp) == sizeof(buf) && fflush(_fp) == 0;
+}
+
+Outbox::Outbox(OutboxStore& store) : _store(store), _rejected(0) {
+    if ( !_store.loadState(_state) ||
+         _state.head >= _store.capacity() || _state.used > _store.capacity() ||
+         (_state.count == 0) != (_state.used == 0)) {
+        _state.head = _state.used = _state.count = 0;
+    }
+}
+
+bool Outbox::push(const std::string& remoteAddr, unsigned int port, const uint8_t *p_data, size_t length, int options) {
+    size_t sz = record_header_size+remoteAddr.length()+length;
+    if ( remoteAddr.length() > 0xFF || length > 0xFFFF || sz > _store.capacity()-_state.used) {
+        _rejected++;
+        return false;
+    }
+
+    uint8_t hdr[record_header_size];
+    hdr[0] = (uint8_t)(length >> 8);
+    hdr[1] = (uint8_t)length;
+    hdr[2] = (uint8_t)(port >> 8);
+    hdr[3] = (uint8_t)port;
+    hdr[4] = (uint8_t)options;
+    hdr[5] = (uint8_t)remoteAddr.length();
+
+    // record first, then state, so an interrupted push leaves the outbox as it was
+    size_t pos = _state.head+_state.used;
+    if ( !write_ring(pos, hdr, sizeof(hdr)) ||
+         !write_ring(pos+sizeof(hdr), (const uint8_t*)remoteAddr.data(), remoteAddr.length()) ||
+         !write_ring(pos+sizeof(hdr)+remoteAddr.length(), p_data, length)) {
+        _rejected++;
+        return false;
+    }
+
+    OutboxState s = _state;
+    s.used += sz;
+    s.count++;
+    if ( !_store.saveState(s)) {
+        _rejected++;
+        return false;
+    }
+    _state = s;
+    return true;
+}
+
+bool Outbox::peek(std::string& remoteAddr, unsigned int& port, uint8_t *p_buf, size_t sz_buf, size_t& length, int& options) {
+    if ( _state.count == 0) {
+        return false;
+    }
+
+    uint8_t hdr[record_header_size];
+    if ( !read_ring(_state.head, hdr, sizeof(hdr))) {
+        return false;
+    }
+    length = ((size_t)hdr[0] << 8) | hdr[1];
+    port = ((unsigned int)hdr[2] << 8) | hdr[3];
+    options = hdr[4];
+    if ( length > sz_buf) {
+        return false;
+    }
+
+    char addr[0x100];
+    size_t addr_len = hdr[5];
+    if ( !read_ring(_state.head+sizeof(hdr), (uint8_t*)addr, addr_len) ||
+         !read_ring(_state.head+sizeof(hdr)+addr_len, p_buf, length)) {
+        return false;
+    }
+    remoteAddr.assign(addr, addr_len);
+    return true;
+}
+
+bool Outbox::pop() {
+    if ( _state.count == 0) {
+        return false;
+    }
+
+    uint8_t hdr[record_header_size];
+    if ( !read_ring(_state.head, hdr, sizeof(hdr))) {
+        return false;
+    }
+    size_t sz = record_header_size+hdr[5]+(((size_t)hdr[0] << 8) | hdr[1]);
+
+    OutboxState s = _state;
+    s.head = (uint32_t)((s.head+sz) % _store.capacity());
+    s.used -= sz;
+    s.count--;
+    if ( s.count == 0) {
+        s.head = 0;
+    }
+    if ( !_store.saveState(s)) {
+        return false;
+    }
+    _state = s;
+    return true;
+}
+
+void Outbox::clear() {
+    _state.head = _state.used = _state.count = 0;
+    _store.saveState(_state);
+}
+
+bool Outbox::read_ring(size_t pos, uint8_t *p_data, size_t length) {
+    size_t cap = _store.capacity();
+    pos %= cap;
+    size_t n = (length < cap-pos) ? length : cap-pos;
+    if ( n > 0 && !_store.read(pos, p_data, n)) {
+        return false;
+    }
+    return n == length || _store.read(0, p_data+n, length-n);
+}
+
+bool Outbox::write_ring(size_t pos, const uint8_t *p_data, size_t length) {
+    size_t cap = _store.capacity();
+    pos %= cap;
+    size_t n = (length < cap-pos) ? length : cap-pos;
+    if ( n > 0 && !_store.write(pos, p_data, n)) {
+        return false;
+    }
+    return n == length || _store.write(0, p_data+n, length-n);
+}
+
+}
@@ -0,0 +1,144 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+namespace Narrowband {
+
+// Read/write position of an Outbox ring, kept by the backing store
+// so that queued messages survive a restart.
+struct OutboxState {
+    uint32_t    head;           // offset of oldest record
+    uint32_t    used;           // bytes in use
+    uint32_t    count;          // number of records
+};
+
+// Fixed size byte area holding the records of an Outbox.
+class OutboxStore {
+public:
+    virtual ~OutboxStore() { }
+
+    // size of data area in bytes
+    virtual size_t capacity() const = 0;
+
+    // read/write within data area, offset+length <= capacity()
+    virtual bool read(size_t offset, uint8_t *p_data, size_t length) = 0;
+    virtual bool write(size_t offset, const uint8_t *p_data, size_t length) = 0;
+
+    // returns false if there is no valid state, the outbox starts empty then
+    virtual bool loadState(OutboxState&) = 0;
+    virtual bool saveState(const OutboxState&) = 0;
+};
+
+// keeps records in a caller supplied buffer, lost on reset
+class RAMOutboxStore : public OutboxStore {
+public:
+    RAMOutboxStore(uint8_t *p_buf, size_t sz_buf);
+
+    virtual size_t capacity() const { return _sz_buf; }
+    virtual bool read(size_t offset, uint8_t *p_data, size_t length);
+    virtual bool write(size_t offset, const uint8_t *p_data, size_t length);
+    virtual bool loadState(OutboxState&);
+    virtual bool saveState(const OutboxState&);
+
+private:
+    uint8_t         *_p_buf;
+    size_t          _sz_buf;
+    OutboxState     _state;
+    bool            _b_valid;
+};
+
+// keeps records in a file of 16+capacity bytes, e.g. on a flash
+// file system mounted by the application, or a plain file on the host.
+// File starts with a header (magic, head, used, count; 32 bit little endian).
+class FileOutboxStore : public OutboxStore {
+public:
+    FileOutboxStore(const char *p_path, size_t capacity);
+    virtual ~FileOutboxStore();
+
+    // false if the file could not be opened or created
+    bool isOpen() const { return _fp != NULL; }
+
+    virtual size_t capacity() const { return _capacity; }
+    virtual bool read(size_t offset, uint8_t *p_data, size_t length);
+    virtual bool write(size_t offset, const uint8_t *p_data, size_t length);
+    virtual bool loadState(OutboxState&);
+    virtual bool saveState(const OutboxState&);
+
+    static const size_t header_size = 16;
+
+private:
+    FileOutboxStore(const FileOutboxStore&);
+    FileOutboxStore& operator=(const FileOutboxStore&);
+
+    FILE            *_fp;
+    size_t          _capacity;
+};
+
+// Bounded FIFO of outgoing datagrams on top of an OutboxStore. Each record
+// holds destination, send options and payload. When full, push() fails
+// and the message is counted as rejected.
+class Outbox {
+public:
+    // per record overhead besides address and payload
+    static const size_t record_header_size = 6;
+
+    // restores queued records from store
+    Outbox(OutboxStore& store);
+
+    bool push(const std::string& remoteAddr, unsigned int port, const uint8_t *p_data, size_t length, int options);
+
+    // copies the oldest record without removing it. Returns false if
+    // empty, or if payload does not fit into sz_buf.
+    bool peek(std::string& remoteAddr, unsigned int& port, uint8_t *p_buf, size_t sz_buf, size_t& length, int& options);
+
+    // removes the oldest record
+    bool pop();
+
+    void clear();
+
+    bool empty() const { return _state.count == 0; }
+    size_t count() const { return _state.count; }
+    size_t used() const { return _state.used; }
+    size_t capacity() const { return _store.capacity(); }
+
+    // messages not queued because outbox was full
+    unsigned long rejected() const { return _rejected; }
+
+protected:
+    // read/write at ring position, wraps around end of data area
+    bool read_ring(size_t pos, uint8_t *p_data, size_t length);
+    bool write_ring(size_t pos, const uint8_t *p_data, size_t length);
+
+    OutboxStore&    _store;
+    OutboxState     _state;
+    unsigned long   _rejected;
+
+private:
+    Outbox(const Outbox&);
+    Outbox& operator=(const Outbox&);
+};
+
+}
@@ -0,0 +1,159 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#include <mbed.h>
+#include <cstdlib>
+#include "retryadapter.h"
+
+namespace Narrowband {
+
+// +CME ERROR codes worth repeating the command for, sorted. Anything
+// else is permanent (e.g. 3 operation not allowed, 4 not supported).
+static const uint16_t transient_cme_errors[] = {
+    14,         // SIM busy
+    30,         // no network service
+    31,         // network timeout
+    159,        // uplink busy / flow control
+    513,        // TUP not registered
+    514,        // AT internal error
+    522,        // UART parity error
+    523,        // UART frame error
+    527         // command interrupted
+};
+
+RetryingCommandAdapter::RetryingCommandAdapter(CommandAdapterBase& ca, const RetryPolicy& policy) :
+    CommandAdapterBase(), _ca(ca), _policy(policy) {
+}
+
+bool RetryingCommandAdapter::isTransient(unsigned int code) {
+    size_t lo = 0;
+    size_t hi = sizeof(transient_cme_errors)/sizeof(transient_cme_errors[0]);
+    while ( lo < hi) {
+        size_t mid = (lo+hi)/2;
+        if ( transient_cme_errors[mid] == code) {
+            return true;
+        }
+        if ( transient_cme_errors[mid] < code) {
+            lo = mid+1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+bool RetryingCommandAdapter::send(const char *p_cmd, ModemResponse& r, unsigned long timeout) {
+    return exchange(p_cmd, NULL, 0, false, r, timeout);
+}
+
+bool RetryingCommandAdapter::send(const char *p_cmd, Callback<void(ModemResponse&)> cb, unsigned long timeout) {
+    ModemResponse r;
+    if ( exchange(p_cmd, NULL, 0, false, r, timeout)) {
+        cb(r);
+        return true;
+    }
+    return false;
+}
+
+bool RetryingCommandAdapter::sendPayload(const char *p_header, const uint8_t *p_payload, size_t length, ModemResponse& r, unsigned long timeout) {
+    return exchange(p_header, p_payload, length, true, r, timeout);
+}
+
+bool RetryingCommandAdapter::exchange(const char *p_cmd, const uint8_t *p_payload, size_t length, bool b_payload, ModemResponse& r, unsigned long timeout) {
+    if ( p_cmd == NULL) {
+        return false;
+    }
+    unsigned int retries = 0;
+    for (;;) {
+        r = ModemResponse();
+        bool b_sent = b_payload?_ca.sendPayload(p_cmd, p_payload, length, r, timeout):_ca.send(p_cmd, r, timeout);
+
+        bool b_retry = b_sent?(r.hasError() && isTransient(r.getErrCode())):_policy.b_retry_timeouts;
+        if ( !b_retry || retries >= _policy.max_retries) {
+            record(p_cmd, retries, b_sent, r);
+            return b_sent;
+        }
+        retries++;
+        Thread::wait(backoff(retries));
+    }
+}
+
+unsigned long RetryingCommandAdapter::backoff(unsigned int n) const {
+    unsigned long d = _policy.base_delay;
+    for ( unsigned int i = 1; i < n && d < _policy.max_delay; i++) {
+        d *= 2;
+    }
+    if ( d > _policy.max_delay) {
+        d = _policy.max_delay;
+    }
+    // half fixed, half random, so modems failing together spread out
+    return d/2 + rand()%(d/2+1);
+}
+
+void RetryingCommandAdapter::record(const char *p_cmd, unsigned int retries, bool b_sent, const ModemResponse& r) {
+    _mtx.lock();
+    RetryStats& s = _stats[command_verb(p_cmd)];
+    s.commands++;
+    s.retries += retries;
+    if ( b_sent && !r.hasError()) {
+        if ( retries > 0) {
+            s.recovered++;
+        }
+    } else if ( b_sent && !isTransient(r.getErrCode())) {
+        s.permanent++;
+    } else if ( b_sent || retries > 0) {
+        // transient error left, also with max_retries 0. Timeouts
+        // only count if they were retried.
+        s.gave_up++;
+    }
+    _mtx.unlock();
+}
+
+bool RetryingCommandAdapter::retryStats(const char *p_cmd, RetryStats& s) const {
+    _mtx.lock();
+    map<string, RetryStats>::const_iterator it = _stats.find(command_verb(p_cmd));
+    bool res = (it != _stats.end());
+    if ( res) {
+        s = it->second;
+    }
+    _mtx.unlock();
+    return res;
+}
+
+void RetryingCommandAdapter::totalStats(RetryStats& s) const {
+    memset(&s, 0, sizeof(s));
+    _mtx.lock();
+    for ( map<string, RetryStats>::const_iterator it = _stats.begin(); it != _stats.end(); ++it) {
+        s.commands += it->second.commands;
+        s.retries += it->second.retries;
+        s.recovered += it->second.recovered;
+        s.gave_up += it->second.gave_up;
+        s.permanent += it->second.permanent;
+    }
+    _mtx.unlock();
+}
+
+void RetryingCommandAdapter::resetStats() {
+    _mtx.lock();
+    _stats.clear();
+    _mtx.unlock();
+}
+
+}
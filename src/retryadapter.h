@@ -0,0 +1,96 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#pragma once
+
+#include "commandadapter.h"
+#include <map>
+#include <string>
+
+namespace Narrowband {
+
+// when RetryingCommandAdapter repeats a command
+struct RetryPolicy {
+    unsigned int    max_retries;            // extra attempts after the first one
+    unsigned long   base_delay;             // msecs before the first retry, doubled on each retry
+    unsigned long   max_delay;              // msecs, cap of the delay
+    bool            b_retry_timeouts;       // also retry commands that got no response
+
+    RetryPolicy() : max_retries(3), base_delay(100), max_delay(2000), b_retry_timeouts(false) { }
+};
+
+struct RetryStats {
+    unsigned long   commands;               // commands sent
+    unsigned long   retries;                // attempts after the first one
+    unsigned long   recovered;              // commands that succeeded after retrying
+    unsigned long   gave_up;                // transient errors left after max_retries
+    unsigned long   permanent;              // errors not retried
+};
+
+// CommandAdapterBase that repeats commands failing with a transient
+// +CME ERROR (e.g. 159, uplink busy), with capped exponential backoff
+// and jitter. Other errors are returned right away. Requires error
+// codes (AT+CMEE=1), a plain ERROR counts as permanent. Use it in
+// place of the adapter it wraps, e.g.
+//   RetryingCommandAdapter rca(mca);
+//   NarrowbandCore nbc(rca);
+class RetryingCommandAdapter : public CommandAdapterBase {
+public:
+    RetryingCommandAdapter(CommandAdapterBase& ca, const RetryPolicy& policy = RetryPolicy());
+
+    bool send(const char *p_cmd, ModemResponse& r, unsigned long timeout);
+    bool send(const char *p_cmd, Callback<void(ModemResponse&)> cb, unsigned long timeout);
+    bool sendPayload(const char *p_header, const uint8_t *p_payload, size_t length, ModemResponse& r, unsigned long timeout);
+
+    bool addURCHandler(Callback<void(ModemResponse&)> cb) { return _ca.addURCHandler(cb); }
+    bool removeURCHandler(Callback<void(ModemResponse&)> cb) { return _ca.removeURCHandler(cb); }
+    CommandPriority setCommandPriority(CommandPriority p) { return _ca.setCommandPriority(p); }
+    bool cancel() { return _ca.cancel(); }
+
+    RetryPolicy& policy() { return _policy; }
+
+    // true if a command failing with +CME ERROR code is worth repeating
+    static bool isTransient(unsigned int code);
+
+    // counters of the verb of p_cmd (e.g. "AT+NSOST="), false if not sent yet
+    bool retryStats(const char *p_cmd, RetryStats& s) const;
+
+    // counters of all commands
+    void totalStats(RetryStats& s) const;
+
+    void resetStats();
+
+protected:
+    // sends until the response is final, returns as the wrapped adapter
+    bool exchange(const char *p_cmd, const uint8_t *p_payload, size_t length, bool b_payload, ModemResponse& r, unsigned long timeout);
+
+    // msecs to wait before retry n (1, 2, ..)
+    unsigned long backoff(unsigned int n) const;
+
+    void record(const char *p_cmd, unsigned int retries, bool b_sent, const ModemResponse& r);
+
+    CommandAdapterBase&         _ca;
+    RetryPolicy                 _policy;
+
+    mutable Mutex               _mtx;                   // guards _stats
+    map<string, RetryStats>     _stats;                 // by verb
+};
+
+}
@@ -0,0 +1,78 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#pragma once
+
+#include <mbed.h>
+#include <cstddef>
+
+namespace Narrowband {
+
+// Lock-free ring of bytes for exactly one producer (e.g. an ISR) and
+// one consumer thread. Each side only writes its own index, the
+// barriers order the data against the index update. N is a power of two.
+template <size_t N>
+class SPSCRing {
+public:
+    SPSCRing() : _head(0), _tail(0) { }
+
+    // producer side. false if full, the byte is dropped.
+    bool push(uint8_t c) {
+        size_t h = _head;
+        if ( h-_tail >= N) {
+            return false;
+        }
+        _buf[h & (N-1)] = c;
+        __DMB();
+        _head = h+1;
+        return true;
+    }
+
+    // consumer side. false if empty.
+    bool pop(uint8_t& c) {
+        size_t t = _tail;
+        if ( t == _head) {
+            return false;
+        }
+        __DMB();
+        c = _buf[t & (N-1)];
+        __DMB();
+        _tail = t+1;
+        return true;
+    }
+
+    size_t size() const { return _head-_tail; }
+    bool empty() const { return _head == _tail; }
+    bool full() const { return _head-_tail >= N; }
+
+    // consumer side, drops everything written so far
+    void clear() { _tail = _head; }
+
+private:
+    // indices run freely, wrap around at the end of size_t
+    volatile size_t     _head;                  // written by producer
+    volatile size_t     _tail;                  // written by consumer
+    uint8_t             _buf[N];
+
+    // N must be a power of two
+    typedef char power_of_two_check[((N & (N-1)) == 0 && N > 0)?1:-1];
+};
+
+}
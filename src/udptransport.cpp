@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#include "udptransport.h"
+
+namespace Narrowband {
+
+UDPSocketTransport::UDPSocketTransport(UDPSocketControl& sc, const string& remoteAddr, unsigned int remotePort,
+                                       size_t max_datagram) :
+    _sc(sc), _remoteAddr(remoteAddr), _remotePort(remotePort), _max_datagram(max_datagram) {
+}
+
+bool UDPSocketTransport::send(const uint8_t *p_data, size_t length) {
+    return _sc.sendTo(_remoteAddr.c_str(), _remotePort, length, p_data);
+}
+
+bool UDPSocketTransport::receive(uint8_t *p_buf, size_t sz_buf, size_t& length, unsigned long timeout) {
+    uint64_t start = Kernel::get_ms_count();
+    while ( true) {
+        if ( _sc.pending() == 0) {
+            uint64_t elapsed = Kernel::get_ms_count()-start;
+            if ( elapsed >= timeout || !_sc.waitForData(timeout-elapsed)) {
+                return false;
+            }
+        }
+
+        // read the whole datagram, drop what does not fit
+        string addr;
+        unsigned int port = 0;
+        size_t n = 0, remaining = 0;
+        bool b_read = true;
+        length = 0;
+        do {
+            uint8_t discard[UDPSocketControl::max_recv_chunk];
+            bool b_fits = length < sz_buf;
+            b_read = _sc.recvFrom(b_fits?sz_buf-length:sizeof(discard), b_fits?p_buf+length:discard, addr, port, n, remaining);
+            if ( b_read && b_fits) {
+                length += n;
+            }
+        } while ( b_read && remaining > 0);
+
+        if ( b_read && addr == _remoteAddr && port == _remotePort) {
+            return true;
+        }
+        if ( !b_read) {
+            // stale notification or modem error, keep waiting for the
+            // next datagram until the deadline
+            if ( Kernel::get_ms_count()-start >= timeout) {
+                return false;
+            }
+            if ( _sc.pending() > 0) {
+                Thread::wait(retry_delay);
+            }
+        }
+    }
+}
+
+unsigned long UDPSocketTransport::now() {
+    return (unsigned long)Kernel::get_ms_count();
+}
+
+}
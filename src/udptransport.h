@@ -0,0 +1,53 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+#pragma once
+
+#include "datagramtransport.h"
+#include "controls.h"
+#include <string>
+
+namespace Narrowband {
+
+// DatagramTransport over an open UDPSocketControl. The socket has to
+// be opened with receive control (setReceiveControl()) to get replies.
+// Datagrams from other peers are dropped. max_datagram is the module's
+// limit, e.g. NarrowbandCore::profile().max_payload.
+class UDPSocketTransport : public DatagramTransport {
+public:
+    // msecs between reads while a failed one left data notified
+    static const unsigned long retry_delay = 10;
+
+    UDPSocketTransport(UDPSocketControl& sc, const string& remoteAddr, unsigned int remotePort,
+                       size_t max_datagram = UDPSocketControl::max_payload);
+
+    virtual bool send(const uint8_t *p_data, size_t length);
+    virtual bool receive(uint8_t *p_buf, size_t sz_buf, size_t& length, unsigned long timeout);
+    virtual unsigned long now();
+    virtual size_t maxDatagram() { return _max_datagram; }
+
+protected:
+    UDPSocketControl&   _sc;
+    string              _remoteAddr;
+    unsigned int        _remotePort;
+    size_t              _max_datagram;
+};
+
+}
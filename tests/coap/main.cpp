@@ -0,0 +1,276 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+// Host test for the CoAP client against a stand-in server on a local
+// UDP port. Covers piggybacked and separate responses, retransmission
+// of a dropped request, non-confirmable requests and block-wise upload.
+//
+// Build and run on the host from the repository root:
+//   g++ -Isrc tests/coap/main.cpp src/coap.cpp -o coap_test -lpthread
+//   ./coap_test
+//
+// Takes a few seconds, the dropped request is retransmitted after
+// CoapClient::ack_timeout.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "coap.h"
+
+using namespace Narrowband;
+
+static int num_failed = 0;
+
+#define CHECK(expr) do { if (!(expr)) { printf("FAILED line %d: %s\n", __LINE__, #expr); num_failed++; } } while(0)
+
+// UDP socket connected to the peer
+class PosixUDPTransport : public DatagramTransport {
+public:
+    PosixUDPTransport(int fd, size_t max_datagram = default_max_datagram) : _fd(fd), _max_datagram(max_datagram) { }
+
+    virtual bool send(const uint8_t *p_data, size_t length) {
+        return ::send(_fd, p_data, length, 0) == (ssize_t)length;
+    }
+
+    virtual bool receive(uint8_t *p_buf, size_t sz_buf, size_t& length, unsigned long timeout) {
+        struct pollfd pfd = { _fd, POLLIN, 0 };
+        if ( poll(&pfd, 1, (int)timeout) <= 0) {
+            return false;
+        }
+        ssize_t n = recv(_fd, p_buf, sz_buf, 0);
+        if ( n < 0) {
+            return false;
+        }
+        length = (size_t)n;
+        return true;
+    }
+
+    virtual unsigned long now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long)(ts.tv_sec*1000+ts.tv_nsec/1000000);
+    }
+
+    virtual size_t maxDatagram() { return _max_datagram; }
+
+private:
+    int _fd;
+    size_t _max_datagram;
+};
+
+static int udp_socket(struct sockaddr_in& addr) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (struct sockaddr*)&addr, &len);
+    return fd;
+}
+
+static const size_t upload_size = 3000;
+
+static uint8_t upload_byte(size_t i) {
+    return (uint8_t)(i*7+i/256);
+}
+
+// stand-in server
+static int server_fd;
+static volatile bool server_stop = false;
+static int dropped = 0;
+static int blocks_received = 0;
+static size_t largest_block = 0;
+static uint8_t upload[upload_size];
+static size_t upload_length = 0;
+
+static bool path_is(const CoapMessage& m, const char *p_path) {
+    CoapOption o;
+    return coap_find_option(m, CoapOptionUriPath, o) && o.length == strlen(p_path) && memcmp(o.p_value, p_path, o.length) == 0;
+}
+
+static void reply(const struct sockaddr_in& to, uint8_t type, uint8_t code, uint16_t mid, const CoapMessage& req,
+                  const CoapOption *p_options, size_t n_options, const char *p_payload) {
+    uint8_t buf[256];
+    size_t n = coap_encode(buf, sizeof(buf), type, code, mid, req.token, req.tkl, p_options, n_options,
+                           (const uint8_t*)p_payload, (p_payload != NULL)?strlen(p_payload):0);
+    sendto(server_fd, buf, n, 0, (const struct sockaddr*)&to, sizeof(to));
+}
+
+static void *server(void *) {
+    uint8_t buf[2048];
+    uint16_t separate_mid = 0x7000;
+    while ( !server_stop) {
+        struct pollfd pfd = { server_fd, POLLIN, 0 };
+        if ( poll(&pfd, 1, 50) <= 0) {
+            continue;
+        }
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(server_fd, buf, sizeof(buf), 0, (struct sockaddr*)&from, &from_len);
+        CoapMessage m;
+        if ( n <= 0 || !coap_decode(buf, (size_t)n, m) || m.code == CoapEmpty) {
+            continue;
+        }
+
+        if ( path_is(m, "hello")) {
+            // first transmission gets lost
+            if ( dropped++ == 0) {
+                continue;
+            }
+            reply(from, CoapAcknowledgement, CoapContent, m.mid, m, NULL, 0, "world");
+        } else if ( path_is(m, "non")) {
+            reply(from, CoapNonConfirmable, CoapContent, 0x6000, m, NULL, 0, "non");
+        } else if ( path_is(m, "slow")) {
+            uint8_t empty[4];
+            size_t e = coap_encode(empty, sizeof(empty), CoapAcknowledgement, CoapEmpty, m.mid, NULL, 0, NULL, 0, NULL, 0);
+            sendto(server_fd, empty, e, 0, (const struct sockaddr*)&from, sizeof(from));
+            usleep(100000);
+            reply(from, CoapConfirmable, CoapChanged, separate_mid++, m, NULL, 0, "later");
+        } else if ( path_is(m, "upload")) {
+            CoapOption o;
+            if ( !coap_find_option(m, CoapOptionBlock1, o)) {
+                continue;
+            }
+            uint32_t v = coap_uint_value(o);
+            size_t size = (size_t)16 << (v & 0x07);
+            size_t offset = (v >> 4)*size;
+            if ( offset+m.payload_length <= sizeof(upload)) {
+                memcpy(upload+offset, m.p_payload, m.payload_length);
+                upload_length = offset+m.payload_length;
+            }
+            blocks_received++;
+            if ( (size_t)n > largest_block) {
+                largest_block = (size_t)n;
+            }
+
+            // ask for 512 byte blocks after the first one
+            uint8_t bv[3];
+            CoapOption bo = { CoapOptionBlock1, 0, bv };
+            uint32_t ack_v = (v & ~0x07u) | ((v & 0x07) > 5 ? 5 : (v & 0x07));
+            bo.length = (uint16_t)coap_uint_encode(ack_v, bv);
+            if ( v & 0x08) {
+                reply(from, CoapAcknowledgement, CoapContinue, m.mid, m, &bo, 1, NULL);
+            } else {
+                reply(from, CoapAcknowledgement, CoapChanged, m.mid, m, &bo, 1, "done");
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool payload_is(const CoapResponse& r, const char *p) {
+    return r.payload_length == strlen(p) && memcmp(r.p_payload, p, r.payload_length) == 0;
+}
+
+static void test_codec() {
+    uint8_t buf[64];
+    const char *p_long = "a-path-segment-longer-than-13";
+    CoapOption options[3] = {
+        { CoapOptionUriPath, 1, (const uint8_t*)"x" },
+        { CoapOptionUriPath, (uint16_t)strlen(p_long), (const uint8_t*)p_long },
+        { 2000, 0, NULL }
+    };
+    uint8_t token[2] = { 0xAB, 0xCD };
+    size_t n = coap_encode(buf, sizeof(buf), CoapConfirmable, CoapPost, 0x1234, token, 2, options, 3, (const uint8_t*)"hi", 2);
+    CHECK(n == 4+2+2+(2+strlen(p_long))+3+3);
+
+    CoapMessage m;
+    CHECK(coap_decode(buf, n, m));
+    CHECK(m.type == CoapConfirmable && m.code == CoapPost && m.mid == 0x1234 && m.tkl == 2 && m.token[1] == 0xCD);
+    CHECK(m.payload_length == 2 && memcmp(m.p_payload, "hi", 2) == 0);
+    CoapOption o;
+    CHECK(coap_find_option(m, 2000, o) && o.length == 0);
+    CHECK(!coap_find_option(m, CoapOptionBlock1, o));
+
+    // does not fit, payload marker without payload
+    CHECK(coap_encode(buf, 10, CoapConfirmable, CoapPost, 1, NULL, 0, options, 3, NULL, 0) == 0);
+    uint8_t bad[5] = { 0x40, 0x01, 0x00, 0x01, 0xFF };
+    CHECK(!coap_decode(bad, sizeof(bad), m));
+}
+
+int main() {
+    test_codec();
+
+    struct sockaddr_in server_addr, client_addr;
+    server_fd = udp_socket(server_addr);
+    int client_fd = udp_socket(client_addr);
+    connect(client_fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+
+    pthread_t th;
+    pthread_create(&th, NULL, server, NULL);
+
+    PosixUDPTransport transport(client_fd);
+    static uint8_t tx[1400], rx[1400];
+    CoapClient client(transport, tx, sizeof(tx), rx, sizeof(rx), 12345);
+    CoapResponse r;
+
+    CHECK(client.get("/hello", r));
+    CHECK(r.code == CoapContent && payload_is(r, "world"));
+    CHECK(client.retransmissions() == 1);
+
+    CHECK(client.request(CoapGet, "non", NULL, 0, r, false));
+    CHECK(r.code == CoapContent && payload_is(r, "non"));
+
+    CHECK(client.post("slow", (const uint8_t*)"x", 1, r));
+    CHECK(r.code == CoapChanged && payload_is(r, "later"));
+
+    uint8_t data[upload_size];
+    for ( size_t i = 0; i < sizeof(data); i++) {
+        data[i] = upload_byte(i);
+    }
+    CHECK(client.put("upload", data, sizeof(data), r));
+    CHECK(r.code == CoapChanged && payload_is(r, "done"));
+    CHECK(upload_length == sizeof(data) && memcmp(upload, data, sizeof(data)) == 0);
+    // 1024, then 512 byte blocks
+    CHECK(blocks_received == 5 && client.blockSize() == 512);
+
+    // a module taking 512 byte datagrams, blocks of 256 leave room
+    // for header and options
+    PosixUDPTransport small_transport(client_fd, 512);
+    CoapClient small_client(small_transport, tx, sizeof(tx), rx, sizeof(rx), 54321);
+    blocks_received = 0;
+    largest_block = 0;
+    upload_length = 0;
+    memset(upload, 0, sizeof(upload));
+    CHECK(small_client.put("upload", data, sizeof(data), r));
+    CHECK(r.code == CoapChanged && payload_is(r, "done"));
+    CHECK(upload_length == sizeof(data) && memcmp(upload, data, sizeof(data)) == 0);
+    CHECK(blocks_received == 12 && largest_block <= 512 && largest_block > 256);
+
+    // 500 bytes do not fit with header and options, two blocks then
+    blocks_received = 0;
+    CHECK(small_client.put("upload", data, 500, r));
+    CHECK(blocks_received == 2);
+
+    server_stop = true;
+    pthread_join(th, NULL);
+    close(client_fd);
+    close(server_fd);
+
+    printf("%s\n", (num_failed == 0) ? "OK" : "FAILED");
+    return (num_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,235 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+// Host test for the MQTT-SN client against a stand-in gateway on a
+// local UDP port. Covers connect, topic registration and caching,
+// QoS -1/0/1 publishes, re-registration after an invalid topic ID and
+// a REGISTER sent by the gateway.
+//
+// Build and run on the host from the repository root:
+//   g++ -Isrc tests/mqttsn/main.cpp src/mqttsn.cpp -o mqttsn_test -lpthread
+//   ./mqttsn_test
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "mqttsn.h"
+
+using namespace Narrowband;
+
+static int num_failed = 0;
+
+#define CHECK(expr) do { if (!(expr)) { printf("FAILED line %d: %s\n", __LINE__, #expr); num_failed++; } } while(0)
+
+// UDP socket connected to the peer
+class PosixUDPTransport : public DatagramTransport {
+public:
+    PosixUDPTransport(int fd) : sent_bytes(0), _fd(fd) { }
+
+    virtual bool send(const uint8_t *p_data, size_t length) {
+        sent_bytes = length;
+        return ::send(_fd, p_data, length, 0) == (ssize_t)length;
+    }
+
+    virtual bool receive(uint8_t *p_buf, size_t sz_buf, size_t& length, unsigned long timeout) {
+        struct pollfd pfd = { _fd, POLLIN, 0 };
+        if ( poll(&pfd, 1, (int)timeout) <= 0) {
+            return false;
+        }
+        ssize_t n = recv(_fd, p_buf, sz_buf, 0);
+        if ( n < 0) {
+            return false;
+        }
+        length = (size_t)n;
+        return true;
+    }
+
+    virtual unsigned long now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long)(ts.tv_sec*1000+ts.tv_nsec/1000000);
+    }
+
+    size_t sent_bytes;                      // size of last datagram sent
+
+private:
+    int _fd;
+};
+
+static int udp_socket(struct sockaddr_in& addr) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (struct sockaddr*)&addr, &len);
+    return fd;
+}
+
+// stand-in gateway
+static int gw_fd;
+static volatile bool gw_stop = false;
+static volatile bool gw_forget_topics = false;     // next PUBLISH gets "invalid topic ID"
+static volatile bool gw_send_register = false;     // send a REGISTER before the next PUBACK
+static uint16_t gw_next_topic_id = 0x0101;
+static uint8_t last_flags = 0;
+static uint16_t last_topic_id = 0;
+static int publishes = 0;
+static int gw_regacks = 0;
+
+static void gw_send(const struct sockaddr_in& to, const uint8_t *p, size_t n) {
+    sendto(gw_fd, p, n, 0, (const struct sockaddr*)&to, sizeof(to));
+}
+
+static void *gateway(void *) {
+    uint8_t buf[512];
+    while ( !gw_stop) {
+        struct pollfd pfd = { gw_fd, POLLIN, 0 };
+        if ( poll(&pfd, 1, 50) <= 0) {
+            continue;
+        }
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(gw_fd, buf, sizeof(buf), 0, (struct sockaddr*)&from, &from_len);
+        if ( n < 2 || buf[0] != n) {
+            continue;
+        }
+        uint8_t *p = buf+2;
+        uint8_t r[16];
+
+        switch ( buf[1]) {
+        case MqttSnConnect:
+            r[0] = 3; r[1] = MqttSnConnack; r[2] = MqttSnAccepted;
+            gw_send(from, r, 3);
+            break;
+        case MqttSnRegister:
+            r[0] = 7; r[1] = MqttSnRegack;
+            r[2] = (uint8_t)(gw_next_topic_id >> 8); r[3] = (uint8_t)gw_next_topic_id;
+            r[4] = p[2]; r[5] = p[3]; r[6] = MqttSnAccepted;
+            gw_next_topic_id++;
+            gw_send(from, r, 7);
+            break;
+        case MqttSnRegack:
+            gw_regacks++;
+            break;
+        case MqttSnPublish:
+            publishes++;
+            last_flags = p[0];
+            last_topic_id = (uint16_t)((p[1] << 8) | p[2]);
+            if ( (p[0] & 0x60) != 0x20) {
+                break;
+            }
+            if ( gw_send_register) {
+                gw_send_register = false;
+                uint8_t reg[] = { 10, MqttSnRegister, 0x02, 0x00, 0x00, 0x01, 'a', '/', '+', 'x' };
+                gw_send(from, reg, sizeof(reg));
+            }
+            r[0] = 7; r[1] = MqttSnPuback;
+            memcpy(r+2, p+1, 4);
+            r[6] = gw_forget_topics ? MqttSnRejectedInvalidTopicId : MqttSnAccepted;
+            gw_forget_topics = false;
+            gw_send(from, r, 7);
+            break;
+        case MqttSnPingreq:
+            r[0] = 2; r[1] = MqttSnPingresp;
+            gw_send(from, r, 2);
+            break;
+        case MqttSnDisconnect:
+            r[0] = 2; r[1] = MqttSnDisconnect;
+            gw_send(from, r, 2);
+            break;
+        }
+    }
+    return NULL;
+}
+
+int main() {
+    struct sockaddr_in gw_addr, client_addr;
+    gw_fd = udp_socket(gw_addr);
+    int client_fd = udp_socket(client_addr);
+    connect(client_fd, (struct sockaddr*)&gw_addr, sizeof(gw_addr));
+
+    pthread_t th;
+    pthread_create(&th, NULL, gateway, NULL);
+
+    PosixUDPTransport transport(client_fd);
+    static uint8_t tx[512], rx[512];
+    MqttSnClient client(transport, tx, sizeof(tx), rx, sizeof(rx));
+    const uint8_t data[] = { 0x01, 0x02, 0x03, 0x04 };
+    const char *p_topic = "sensors/room1/temperature";
+
+    // QoS -1 needs no connection, short names only
+    CHECK(client.publish("t1", data, sizeof(data), -1));
+    usleep(50000);
+    CHECK(publishes == 1 && last_flags == 0x62);
+    CHECK(!client.publish(p_topic, data, sizeof(data), -1));
+    CHECK(!client.publish(p_topic, data, sizeof(data), 0));
+
+    CHECK(client.connect("nbiot-1", 600));
+    CHECK(client.isConnected());
+
+    // registered once, then published by ID
+    CHECK(client.publish(p_topic, data, sizeof(data), 1));
+    CHECK(client.publish(p_topic, data, sizeof(data), 1));
+    CHECK(client.registrations() == 1);
+    CHECK(transport.sent_bytes == 7+sizeof(data));
+    CHECK(last_topic_id == 0x0101 && (last_flags & 0x03) == 0);
+
+    // QoS 0 is not acknowledged
+    CHECK(client.publish(p_topic, data, sizeof(data), 0));
+
+    // gateway lost the registration
+    gw_forget_topics = true;
+    CHECK(client.publish(p_topic, data, sizeof(data), 1));
+    CHECK(client.registrations() == 2 && last_topic_id == 0x0102);
+
+    // REGISTER from the gateway while waiting for PUBACK
+    gw_send_register = true;
+    CHECK(client.publish(p_topic, data, sizeof(data), 1));
+    uint16_t id = 0;
+    CHECK(client.registerTopic("a/+x", id) && id == 0x0200);
+    CHECK(client.registrations() == 2);
+
+    CHECK(client.publishPredefined(0x0042, data, sizeof(data), 1));
+    CHECK(last_topic_id == 0x0042 && (last_flags & 0x03) == 1);
+
+    CHECK(client.ping());
+    CHECK(client.disconnect());
+    CHECK(!client.isConnected());
+
+    usleep(100000);
+    CHECK(gw_regacks == 1);
+    CHECK(publishes == 8);
+
+    gw_stop = true;
+    pthread_join(th, NULL);
+    close(client_fd);
+    close(gw_fd);
+
+    printf("%s\n", (num_failed == 0) ? "OK" : "FAILED");
+    return (num_failed == 0) ? 0 : 1;
+}
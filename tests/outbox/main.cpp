@@ -0,0 +1,111 @@
+/*
+ *  Copyright (C) 2018  Digital Incubation & Growth GmbH
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  This software is dual-licensed. For commercial licensing options, please
+ *  contact the authors (see README).
+ */
+
+// Host test for the outbox with a file backed store. Queues records
+// that wrap around the end of the file, reopens the file as after a
+// restart and checks that all records come back in order.
+//
+// Build and run on the host from the repository root:
+//   g++ -Isrc tests/outbox/main.cpp src/outbox.cpp -o outbox_test
+//   ./outbox_test
+
+#include <stdio.h>
+#include <string.h>
+#include "outbox.h"
+
+using namespace Narrowband;
+
+static int num_failed = 0;
+
+#define CHECK(expr) do { if (!(expr)) { printf("FAILED line %d: %s\n", __LINE__, #expr); num_failed++; } } while(0)
+
+static const char *path = "outbox_test.bin";
+static const size_t capacity = 100;
+
+static void make_payload(unsigned int i, uint8_t *p, size_t& length) {
+    length = 5+(i*7) % 23;
+    for ( size_t k = 0; k < length; k++) {
+        p[k] = (uint8_t)(i*31+k);
+    }
+}
+
+static bool check_record(Outbox& ob, unsigned int i) {
+    std::string addr;
+    unsigned int port;
+    uint8_t buf[64], expect[64];
+    size_t length, expect_length;
+    int options;
+
+    make_payload(i, expect, expect_length);
+    return ob.peek(addr, port, buf, sizeof(buf), length, options) &&
+        addr == "192.168.0.1" && port == 5683+i && options == (int)(i % 4) &&
+        length == expect_length && memcmp(buf, expect, length) == 0;
+}
+
+int main() {
+    remove(path);
+
+    unsigned int next_in = 0, next_out = 0;
+    uint8_t payload[64];
+    size_t length;
+
+    // fill, drain partially and refill several times so records wrap
+    for ( int round = 0; round < 20; round++) {
+        {
+            FileOutboxStore store(path, capacity);
+            CHECK(store.isOpen());
+            Outbox ob(store);
+            CHECK(ob.count() == next_in-next_out);
+
+            for ( ;; ) {
+                make_payload(next_in, payload, length);
+                if ( !ob.push("192.168.0.1", 5683+next_in, payload, length, next_in % 4)) {
+                    break;
+                }
+                next_in++;
+            }
+            CHECK(ob.rejected() == 1);
+            CHECK(ob.used() <= capacity);
+        }
+        {
+            // restart, take out all but one record
+            FileOutboxStore store(path, capacity);
+            Outbox ob(store);
+            CHECK(ob.count() == next_in-next_out);
+            while ( ob.count() > 1) {
+                CHECK(check_record(ob, next_out));
+                CHECK(ob.pop());
+                next_out++;
+            }
+        }
+    }
+
+    {
+        FileOutboxStore store(path, capacity);
+        Outbox ob(store);
+        CHECK(check_record(ob, next_out));
+        ob.clear();
+        CHECK(ob.empty());
+    }
+    remove(path);
+
+    printf("%u records, %s\n", next_in, (num_failed == 0) ? "OK" : "FAILED");
+    return (num_failed == 0) ? 0 : 1;
+}